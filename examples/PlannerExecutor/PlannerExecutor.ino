@@ -0,0 +1,78 @@
+/*
+
+Plans moves on one core and steps the motor on the other.
+Developed for the Raspberry Pi Pico (RP2040) using the Earle Philhower core, which runs setup1() and loop1() on the second core.
+On other dual-core boards, run the executor's loop in a task pinned to the second core, or call move() from a timer interrupt.
+
+This software is licensed under the GPL v3
+
+*/
+
+// pinout
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+
+// drive mode and steps per revolution
+static const uint8_t DRIVE_MODE = 8; // drive mode (number of microsteps taken, eg 1/8th stepping = 8)
+static const uint16_t REVOLUTION_FULL_STEPS = 200; // number of full steps in one revolution of the test motor (see your motor's specs/datasheet)
+static const uint32_t REVOLUTION_PULSES = REVOLUTION_FULL_STEPS * DRIVE_MODE; // number of microsteps in one revolution of the test motor
+
+#include <kissStepper.h>
+// the queue connects the planner (first core) to the executor (second core)
+kissSegmentQueue queue;
+kissStepperPlanner planner(queue);
+kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+
+// one revolution forwards, then one back, then a pause before starting over
+static const int32_t TARGETS[] = {REVOLUTION_PULSES, 0};
+static const uint8_t TARGET_COUNT = sizeof(TARGETS) / sizeof(TARGETS[0]);
+static const uint32_t PAUSE_MS = 1000;
+static uint8_t nextTarget = 0;
+static uint32_t pauseStart = 0;
+
+// ----------------------------------------------------------------------------------------------------
+// First core: plan moves, and do everything else your sketch needs to do
+// ----------------------------------------------------------------------------------------------------
+
+void loop(void)
+{
+    // top up the queue once per pass, so the rest of loop() gets a turn while the motor moves
+    if (planner.plan() == STATE_STOPPED)
+    {
+        if (nextTarget < TARGET_COUNT)
+        {
+            // the previous move is completely queued, so queue the next one behind it
+            planner.prepareMove(TARGETS[nextTarget]);
+            nextTarget++;
+        }
+        // the executor's getState() is safe to call from this core, and waits for the queue to empty too
+        else if (executor.getState() != STATE_STOPPED)
+            pauseStart = millis();
+        else if (millis() - pauseStart >= PAUSE_MS)
+            nextTarget = 0;
+    }
+
+    // do everything else your sketch needs to do here
+    // keep each pass short, plan() has to be called often enough to keep the queue from running dry
+}
+
+void setup(void)
+{
+    planner.setMaxSpeed(REVOLUTION_PULSES * 2);
+    planner.setAccel(REVOLUTION_PULSES);
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Second core: step the motor
+// ----------------------------------------------------------------------------------------------------
+
+void loop1(void)
+{
+    executor.move();
+}
+
+void setup1(void)
+{
+    executor.begin();
+}
@@ -0,0 +1,159 @@
+/*
+
+Compares the cost and accuracy of the ramp approximations selectable with setRamp().
+For each approximation, and each speed/acceleration pair below, it reports:
+- cycles per ramp step, for the approximation alone (a loop doing everything else is timed
+  separately and subtracted)
+- the worst velocity error over the ramp, compared with the exact formula
+- the velocity error at the end of the ramp
+
+Ramps longer than MAX_RAMP_STEPS are only checked up to that many steps, marked with a *.
+With the settings below, it takes about a minute on a 16 MHz AVR.
+
+No motor is needed. Change the speeds and accelerations to cover the range your project uses,
+then pick the cheapest approximation that meets your positioning tolerance.
+
+This software is licensed under the GPL v3
+
+*/
+
+#include <kissStepper.h>
+
+static const uint32_t ONE_SECOND = 1000000UL;
+
+static const uint8_t SPEED_COUNT = 4;
+static const uint16_t testSpeeds[SPEED_COUNT] = {400, 1600, 6400, 25600};
+static const uint8_t ACCEL_COUNT = 3;
+static const uint16_t testAccels[ACCEL_COUNT] = {1600, 6400, 25600};
+
+static const uint32_t MAX_RAMP_STEPS = 20000;
+static const uint32_t TIMED_STEPS = 10000;
+
+static const uint8_t RAMP_COUNT = 3;
+static const kissRamp_t ramps[RAMP_COUNT] = {RAMP_FAST, RAMP_BETTER, RAMP_BEST};
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+void printRampName(kissRamp_t ramp)
+{
+    switch (ramp)
+    {
+    case RAMP_BETTER:
+        Serial.print(F("RAMP_BETTER"));
+        break;
+    case RAMP_BEST:
+        Serial.print(F("RAMP_BEST  "));
+        break;
+    default:
+        Serial.print(F("RAMP_FAST  "));
+        break;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Times TIMED_STEPS ramp steps, repeating the ramp as needed
+// With approximate = false, the approximation is left out to time everything else
+// ----------------------------------------------------------------------------------------------------
+
+uint32_t timeRamp(kissRamp_t ramp, bool approximate, float firstStepInterval, float topSpeedStepInterval, float constMult, uint32_t accelDist)
+{
+    uint32_t steps = 0;
+    volatile float sink = firstStepInterval;
+    float stepInterval;
+    uint32_t startTime = micros();
+    while (steps < TIMED_STEPS)
+    {
+        stepInterval = firstStepInterval;
+        for (uint32_t n = 1; (n < accelDist) && (steps < TIMED_STEPS); n++, steps++)
+        {
+            if (approximate)
+                stepInterval = kissAccelStep(stepInterval, constMult, ramp);
+            else
+                stepInterval = sink;
+            if (stepInterval < topSpeedStepInterval) stepInterval = topSpeedStepInterval;
+        }
+        sink = stepInterval;
+    }
+    return micros() - startTime;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Walks through an acceleration ramp the same way kissStepper does, comparing against the exact speed
+// ----------------------------------------------------------------------------------------------------
+
+void testRamp(kissRamp_t ramp, uint16_t maxSpeed, uint16_t accel)
+{
+    float constMult = ((float)accel / ONE_SECOND) / ONE_SECOND;
+    float minSpeed = sqrt(2.0 * accel);
+    float topSpeedStepInterval = ONE_SECOND / (float)maxSpeed;
+    uint32_t accelDist = ((uint32_t)maxSpeed * maxSpeed) / (2UL * accel);
+    if (accelDist < 2) accelDist = 2;
+
+    // accuracy, over at most MAX_RAMP_STEPS
+    uint32_t checkedDist = (accelDist > MAX_RAMP_STEPS) ? MAX_RAMP_STEPS : accelDist;
+    float stepInterval = ONE_SECOND / minSpeed;
+    float maxError = 0;
+    float error = 0;
+    for (uint32_t n = 1; n < checkedDist; n++)
+    {
+        stepInterval = kissAccelStep(stepInterval, constMult, ramp);
+        if (stepInterval < topSpeedStepInterval) stepInterval = topSpeedStepInterval;
+
+        // after n+1 steps from rest, the exact speed is sqrt(2*a*(n+1))
+        float exactSpeed = sqrt(2.0 * accel * (n + 1));
+        if (exactSpeed > maxSpeed) exactSpeed = maxSpeed;
+        float speed = ONE_SECOND / stepInterval;
+        error = fabs(speed - exactSpeed) / exactSpeed;
+        if (error > maxError) maxError = error;
+    }
+
+    // cost, timed over the same ramp, less the cost of the loop around the approximation
+    uint32_t elapsed = timeRamp(ramp, true, ONE_SECOND / minSpeed, topSpeedStepInterval, constMult, accelDist);
+    uint32_t overhead = timeRamp(ramp, false, ONE_SECOND / minSpeed, topSpeedStepInterval, constMult, accelDist);
+    elapsed = (elapsed > overhead) ? (elapsed - overhead) : 0;
+    float cyclesPerStep = ((float)elapsed * (F_CPU / ONE_SECOND)) / TIMED_STEPS;
+
+    printRampName(ramp);
+    Serial.print(F("  speed "));
+    Serial.print(maxSpeed);
+    Serial.print(F("  accel "));
+    Serial.print(accel);
+    Serial.print(F("  cycles/step "));
+    Serial.print(cyclesPerStep, 1);
+    Serial.print(F("  max error % "));
+    Serial.print(maxError * 100.0, 4);
+    Serial.print(F("  final error % "));
+    Serial.print(error * 100.0, 4);
+    if (checkedDist < accelDist)
+        Serial.println(F(" *"));
+    else
+        Serial.println();
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+void loop(void)
+{
+    for (uint8_t i = 0; i < SPEED_COUNT; i++)
+    {
+        for (uint8_t j = 0; j < ACCEL_COUNT; j++)
+        {
+            for (uint8_t r = 0; r < RAMP_COUNT; r++)
+                testRamp(ramps[r], testSpeeds[i], testAccels[j]);
+        }
+        Serial.println();
+    }
+    Serial.print(F("* only the first "));
+    Serial.print(MAX_RAMP_STEPS);
+    Serial.println(F(" steps of the ramp were checked"));
+    Serial.println(F("Done"));
+    while (true);
+}
+
+void setup(void)
+{
+    Serial.begin(9600);
+    while (!Serial);
+}
@@ -0,0 +1,63 @@
+/*
+
+Records the steps taken during a move and prints them over serial.
+Run it on two builds of the library (or two sets of settings) and compare the output to find
+timing and ramp changes. See kissStepTrace::dump() for the format.
+
+By default the trace only holds the last 32 steps, the end of the deceleration. The output
+includes the total number of steps, so partial traces can still be lined up with a full one.
+To capture this whole 1600 step move, add -DKISS_TRACE_SIZE=2048 to your build flags, on a board
+with at least 32 KB of RAM (such as a Teensy 3.5 or later, RP2040 or ESP32).
+
+To check the output against the library on a PC, save it to a file and run
+    extras/host/traceReplay -t 1600 -s 1600 -a 1600 -k 1 <file>
+
+This software is licensed under the GPL v3
+
+*/
+
+// pinout
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+
+// the move to record
+static const int32_t TARGET = 1600;
+static const uint16_t MAX_SPEED = 1600;
+static const uint16_t ACCEL = 1600;
+
+#include <kissStepper.h>
+kissStepper motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+kissStepTrace trace;
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+void loop(void)
+{
+    // record a move away from 0
+    trace.clear();
+    motor.setTrace(&trace);
+    motor.prepareMove(TARGET);
+    while (motor.move() != STATE_STOPPED);
+    motor.setTrace(NULL);
+
+    trace.dump(Serial);
+
+    // return to 0 and wait for a keypress before repeating
+    motor.prepareMove(0);
+    while (motor.move() != STATE_STOPPED);
+    Serial.println(F("\nSend any character to repeat"));
+    while (!Serial.available());
+    while (Serial.available()) Serial.read();
+}
+
+void setup(void)
+{
+    Serial.begin(9600);
+    while (!Serial);
+
+    motor.begin();
+    motor.setMaxSpeed(MAX_SPEED);
+    motor.setAccel(ACCEL);
+}
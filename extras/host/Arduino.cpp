@@ -0,0 +1,10 @@
+// State for the Arduino stand-in, see Arduino.h
+
+#include "Arduino.h"
+
+uint8_t hostPinMode[HOST_PIN_COUNT];
+uint8_t hostPinState[HOST_PIN_COUNT];
+volatile uint32_t hostPorts[HOST_PIN_COUNT];
+
+uint32_t hostTime = 0;
+uint32_t hostTimeStep = 1;
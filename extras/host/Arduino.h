@@ -0,0 +1,91 @@
+/*
+Minimal stand-in for the Arduino core, so kissStepper can be built and tested on a PC.
+See README.md in this folder.
+
+Time is simulated: every call to micros() moves the clock forward by hostTimeStep microseconds
+(1 by default), so code that polls micros() in a loop always makes progress. The clock is not
+shared between threads, so only one thread should call micros().
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#ifndef PI
+	#define PI 3.1415926535897932384626433832795
+#endif
+
+#ifndef F_CPU
+	#define F_CPU 16000000UL
+#endif
+
+#define F(string_literal) (string_literal)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// simulated pins and ports, one port per pin with the pin on bit 0
+static const uint8_t HOST_PIN_COUNT = 64;
+extern uint8_t hostPinMode[HOST_PIN_COUNT];
+extern uint8_t hostPinState[HOST_PIN_COUNT];
+extern volatile uint32_t hostPorts[HOST_PIN_COUNT];
+
+// simulated clock
+extern uint32_t hostTime;
+extern uint32_t hostTimeStep;
+
+inline uint32_t micros(void)
+{
+    hostTime += hostTimeStep;
+    return hostTime;
+}
+inline uint32_t millis(void)
+{
+    return micros() / 1000;
+}
+inline void delayMicroseconds(unsigned int us)
+{
+    hostTime += us;
+}
+inline void delay(unsigned long ms)
+{
+    hostTime += ms * 1000;
+}
+
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+    hostPinMode[pin] = mode;
+}
+inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+    hostPinState[pin] = value ? HIGH : LOW;
+}
+inline int digitalRead(uint8_t pin)
+{
+    return hostPinState[pin];
+}
+
+inline uint32_t digitalPinToBitMask(uint8_t pin)
+{
+    (void)pin;
+    return 1;
+}
+inline uint8_t digitalPinToPort(uint8_t pin)
+{
+    return pin;
+}
+inline volatile uint32_t *portOutputRegister(uint8_t port)
+{
+    return &hostPorts[port];
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+Minimal stand-in for the Arduino Print class, see README.md in this folder.
+FilePrint sends output to a stdio stream.
+*/
+
+#ifndef Print_h
+#define Print_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+class Print
+{
+public:
+    virtual ~Print(void) {};
+    virtual size_t write(uint8_t c) = 0;
+
+    size_t print(const char *s)
+    {
+        size_t n = 0;
+        while (*s) n += write(*s++);
+        return n;
+    }
+    size_t print(char c)
+    {
+        return write(c);
+    }
+    size_t print(unsigned char n)
+    {
+        return print((unsigned long)n);
+    }
+    size_t print(int n)
+    {
+        return print((long)n);
+    }
+    size_t print(unsigned int n)
+    {
+        return print((unsigned long)n);
+    }
+    size_t print(long n)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%ld", n);
+        return print(buf);
+    }
+    size_t print(unsigned long n)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lu", n);
+        return print(buf);
+    }
+    size_t print(double n, int digits = 2)
+    {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%.*f", digits, n);
+        return print(buf);
+    }
+
+    size_t println(void)
+    {
+        return write('\n');
+    }
+    template <typename T> size_t println(T value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+    size_t println(double value, int digits)
+    {
+        size_t n = print(value, digits);
+        return n + println();
+    }
+};
+
+class FilePrint: public Print
+{
+public:
+    FilePrint(FILE *file) : m_file(file) {};
+    size_t write(uint8_t c)
+    {
+        return (fputc(c, m_file) == EOF) ? 0 : 1;
+    }
+
+private:
+    FILE *m_file;
+};
+
+#endif
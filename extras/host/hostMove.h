@@ -0,0 +1,44 @@
+/*
+Runs a whole move on the simulated clock, for the programs in this folder, see README.md.
+*/
+
+#ifndef hostMove_h
+#define hostMove_h
+
+#include <kissStepper.h>
+#include <vector>
+
+// a step, and when it was taken in microseconds since the start of the move
+struct hostStep_t
+{
+    uint32_t time;
+    kissTraceEntry_t entry;
+};
+
+// makes a move, recording it in trace (which is cleared first)
+// if steps isn't NULL, it is cleared and gets every step of the move, however many trace can hold
+template <class motor_t> void runMove(motor_t &motor, kissPos_t target, kissStepTrace &trace, std::vector<hostStep_t> *steps = NULL)
+{
+    trace.clear();
+    if (steps) steps->clear();
+    motor.setTrace(&trace);
+    motor.prepareMove(target);
+    uint32_t start = hostTime;
+    kissState_t state;
+    do
+    {
+        state = motor.move();
+        // move() takes at most one step per call
+        if (steps && (trace.getTotal() > steps->size()))
+        {
+            hostStep_t step;
+            step.time = hostTime - start;
+            step.entry = trace.getEntry(trace.getCount() - 1);
+            steps->push_back(step);
+        }
+    }
+    while (state != STATE_STOPPED);
+    motor.setTrace(NULL);
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+Checks of the motor classes on the simulated clock, one thread only.
+
+- a move starts promptly however long ago the motor controller was enabled
+- the executor doesn't stop, or fall behind, part way through a fast move when the planner only
+  gets a turn every few milliseconds
+- with KISS_WIDE_POSITION (motorChecksWide), positions stay right across 2^32, and a move further
+  than the 32-bit distance counters can hold is cut short instead of wrapping around
+
+Returns non-zero if any check fails.
+*/
+
+#include <kissStepper.h>
+#include <stdio.h>
+
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+static const uint8_t PIN_REDUCE = 8;
+
+// a little over 2^31 microseconds, about 36 minutes
+static const uint32_t LONG_WAIT = 2200000000UL;
+// a 100 step move with the default speed and acceleration takes half a second
+static const uint32_t MOVE_TIMEOUT = 5000000UL;
+
+static uint32_t failures = 0;
+
+static void fail(const char *what, long long expected, long long actual)
+{
+    printf("FAIL: %s (expected %lld, got %lld)\n", what, expected, actual);
+    failures++;
+}
+
+// calls move() until the motor stops, or for timeout microseconds of simulated time
+template <class motor_t> static void runToStop(motor_t &motor, uint32_t timeout)
+{
+    uint32_t start = hostTime;
+    while ((motor.move() != STATE_STOPPED) && (hostTime - start < timeout));
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Waking up
+// ----------------------------------------------------------------------------------------------------
+
+template <class motor_t> static void checkLateMove(motor_t &motor, const char *what, uint16_t wakeTime)
+{
+    motor.begin();
+    motor.setWakeTime(wakeTime);
+    motor.enable();
+    hostTime += LONG_WAIT;
+    motor.prepareMove(100);
+    runToStop(motor, MOVE_TIMEOUT);
+    if (motor.getPos() != 100)
+        fail(what, 100, motor.getPos());
+}
+
+static void checkLateExecutor(uint16_t wakeTime)
+{
+    kissSegmentQueue queue;
+    kissStepperPlanner planner(queue);
+    kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+    executor.begin();
+    executor.setWakeTime(wakeTime);
+    executor.enable();
+    hostTime += LONG_WAIT;
+    planner.prepareMove(100);
+    uint32_t start = hostTime;
+    do
+    {
+        planner.plan();
+        executor.move();
+    }
+    while ((executor.getState() != STATE_STOPPED) && (hostTime - start < MOVE_TIMEOUT));
+    if (executor.getPos() != 100)
+        fail("executor moved after a long wait", 100, executor.getPos());
+}
+
+static void checkWake(void)
+{
+    for (uint16_t wakeTime = 0; wakeTime <= 5000; wakeTime += 5000)
+    {
+        kissStepper accelMotor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+        checkLateMove(accelMotor, "kissStepper moved after a long wait", wakeTime);
+        kissStepperNoAccel noAccelMotor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+        checkLateMove(noAccelMotor, "kissStepperNoAccel moved after a long wait", wakeTime);
+        checkLateExecutor(wakeTime);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Planner falling behind
+// ----------------------------------------------------------------------------------------------------
+
+static void checkSlowPlanner(uint32_t planPeriod)
+{
+    kissSegmentQueue queue;
+    kissStepperPlanner planner(queue);
+    kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+    kissStepTrace trace;
+    planner.setMaxSpeed(20000);
+    planner.setAccel(20000);
+    executor.begin();
+    executor.setReducedCurrentPin(PIN_REDUCE, 0);
+    executor.setTrace(&trace);
+
+    planner.prepareMove(20000);
+    uint32_t lastPlan = hostTime;
+    planner.plan();
+    uint32_t stops = 0;
+    uint32_t lateSteps = 0;
+    uint32_t steps = 0;
+    bool currentReduced = false;
+    while (executor.getPos() != 20000)
+    {
+        if (hostTime - lastPlan >= planPeriod)
+        {
+            lastPlan = hostTime;
+            planner.plan();
+        }
+        // it waits while stopped for the motor controller to wake up, and stops after the last step
+        kissState_t state = executor.move();
+        if ((state == STATE_STOPPED) && (trace.getTotal() > 0) && (executor.getPos() != 20000)) stops++;
+        if (executor.isCurrentReduced()) currentReduced = true;
+        // move() takes at most one step per call
+        if (trace.getTotal() > steps)
+        {
+            steps = trace.getTotal();
+            kissTraceEntry_t entry = trace.getEntry(trace.getCount() - 1);
+            if ((entry.timeDelta != kissStepTrace::NO_TIME_DELTA) && (entry.timeDelta > entry.interval + 1)) lateSteps++;
+        }
+    }
+    executor.move();
+    if (stops)
+        fail("executor stops part way through a move", 0, stops);
+    if (currentReduced)
+        fail("current reduced part way through a move", 0, 1);
+    if (executor.getState() != STATE_STOPPED)
+        fail("executor state at the end of the move", STATE_STOPPED, executor.getState());
+    printf("planner every %lu us: %lu late steps in a 20000 step move at 20 kHz\n", (unsigned long)planPeriod, (unsigned long)lateSteps);
+    if (lateSteps)
+        fail("steps delayed by the planner", 0, lateSteps);
+}
+
+#ifdef KISS_WIDE_POSITION
+// ----------------------------------------------------------------------------------------------------
+// Long travel
+// ----------------------------------------------------------------------------------------------------
+
+static const kissPos_t POS_2_32 = 4294967296LL;
+static const kissPos_t MAX_MOVE_DIST = 4294967295LL;
+static const uint32_t CROSSING_STEPS = 200;
+static const uint32_t LONG_MOVE_STEPS = 5000;
+
+// the position must follow every step, forwards across 2^32 and back again
+template <class motor_t> static void checkCrossing(motor_t &motor, const char *what)
+{
+    kissStepTrace trace;
+    motor.begin();
+    motor.setTrace(&trace);
+    kissPos_t start = POS_2_32 - (CROSSING_STEPS / 2);
+    motor.setPos(start);
+    for (int8_t dir = 1; dir >= -1; dir -= 2)
+    {
+        kissPos_t from = motor.getPos();
+        uint32_t stepsBefore = trace.getTotal();
+        motor.prepareMove(from + dir * (kissPos_t)CROSSING_STEPS);
+        uint32_t start = hostTime;
+        kissState_t state;
+        do
+        {
+            state = motor.move();
+            kissPos_t expected = from + dir * (kissPos_t)(trace.getTotal() - stepsBefore);
+            if (motor.getPos() != expected)
+            {
+                fail(what, expected, motor.getPos());
+                break;
+            }
+        }
+        while ((state != STATE_STOPPED) && (hostTime - start < MOVE_TIMEOUT));
+    }
+    if (motor.getPos() != start)
+        fail(what, start, motor.getPos());
+    motor.setTrace(NULL);
+}
+
+static void checkExecutorCrossing(void)
+{
+    kissSegmentQueue queue;
+    kissStepperPlanner planner(queue);
+    kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+    kissStepTrace trace;
+    executor.begin();
+    executor.setTrace(&trace);
+    kissPos_t start = POS_2_32 - (CROSSING_STEPS / 2);
+    planner.setPos(start);
+    executor.setPos(start);
+    for (int8_t dir = 1; dir >= -1; dir -= 2)
+    {
+        kissPos_t from = executor.getPos();
+        uint32_t stepsBefore = trace.getTotal();
+        planner.prepareMove(from + dir * (kissPos_t)CROSSING_STEPS);
+        uint32_t start = hostTime;
+        do
+        {
+            planner.plan();
+            executor.move();
+            kissPos_t expected = from + dir * (kissPos_t)(trace.getTotal() - stepsBefore);
+            if (executor.getPos() != expected)
+            {
+                fail("executor position across 2^32", expected, executor.getPos());
+                break;
+            }
+        }
+        while ((executor.getState() != STATE_STOPPED) && (hostTime - start < MOVE_TIMEOUT));
+    }
+    if (executor.getPos() != start)
+        fail("executor position across 2^32", start, executor.getPos());
+}
+
+// a move further than MAX_MOVE_DIST is limited to it, then stopped early, well short of the end
+template <class motor_t> static void checkLongMove(motor_t &motor, const char *what)
+{
+    kissStepTrace trace;
+    motor.begin();
+    motor.setTrace(&trace);
+    for (int8_t dir = 1; dir >= -1; dir -= 2)
+    {
+        motor.setPos(0);
+        uint32_t stepsBefore = trace.getTotal();
+        motor.prepareMove(dir * (POS_2_32 + 1000));
+        if (motor.getTarget() != dir * MAX_MOVE_DIST)
+            fail(what, dir * MAX_MOVE_DIST, motor.getTarget());
+        if (motor.getDistRemaining() != (uint32_t)MAX_MOVE_DIST)
+            fail(what, MAX_MOVE_DIST, motor.getDistRemaining());
+        uint32_t start = hostTime;
+        while ((trace.getTotal() - stepsBefore < LONG_MOVE_STEPS) && (hostTime - start < MOVE_TIMEOUT)) motor.move();
+        motor.stop();
+        kissPos_t expected = dir * (kissPos_t)(trace.getTotal() - stepsBefore);
+        if (motor.getPos() != expected)
+            fail(what, expected, motor.getPos());
+        if (trace.getTotal() - stepsBefore < LONG_MOVE_STEPS)
+            fail(what, LONG_MOVE_STEPS, trace.getTotal() - stepsBefore);
+    }
+    motor.setTrace(NULL);
+}
+
+static void checkExecutorLongMove(void)
+{
+    kissSegmentQueue queue;
+    kissStepperPlanner planner(queue);
+    kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+    kissStepTrace trace;
+    executor.begin();
+    executor.setTrace(&trace);
+    for (int8_t dir = 1; dir >= -1; dir -= 2)
+    {
+        planner.setPos(0);
+        executor.setPos(0);
+        uint32_t stepsBefore = trace.getTotal();
+        planner.prepareMove(dir * (POS_2_32 + 1000));
+        uint32_t start = hostTime;
+        while ((trace.getTotal() - stepsBefore < LONG_MOVE_STEPS) && (hostTime - start < MOVE_TIMEOUT))
+        {
+            planner.plan();
+            executor.move();
+        }
+        planner.stop();
+        start = hostTime;
+        do executor.move();
+        while ((executor.getState() != STATE_STOPPED) && (hostTime - start < MOVE_TIMEOUT));
+        kissPos_t expected = dir * (kissPos_t)(trace.getTotal() - stepsBefore);
+        if (executor.getPos() != expected)
+            fail("executor stopped during a move longer than 2^32 steps", expected, executor.getPos());
+        if (trace.getTotal() - stepsBefore < LONG_MOVE_STEPS)
+            fail("executor steps during a move longer than 2^32 steps", LONG_MOVE_STEPS, trace.getTotal() - stepsBefore);
+    }
+}
+
+static void checkLongTravel(void)
+{
+    kissStepper accelMotor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+    checkCrossing(accelMotor, "kissStepper position across 2^32");
+    checkLongMove(accelMotor, "kissStepper move longer than 2^32 steps");
+    kissStepperNoAccel noAccelMotor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+    checkCrossing(noAccelMotor, "kissStepperNoAccel position across 2^32");
+    checkLongMove(noAccelMotor, "kissStepperNoAccel move longer than 2^32 steps");
+    checkExecutorCrossing();
+    checkExecutorLongMove();
+}
+#endif
+
+int main(void)
+{
+    checkWake();
+    checkSlowPlanner(2000);
+#ifdef KISS_WIDE_POSITION
+    checkLongTravel();
+#endif
+
+    if (failures)
+    {
+        printf("%u checks FAILED\n", (unsigned)failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+Two-thread test and benchmark of the split planner/executor.
+
+The planner runs on the main thread and the executor on a second thread, as they would on two
+cores. The main thread keeps reading the executor's position and state while it works, and
+checks that:
+- the position never goes backwards during forward moves, or outside the range of the moves
+- getState() only returns STATE_STOPPED once every queued step has been taken
+- the executor ends up where the planner says it should be
+- stopping from the planner's thread part way through a move stops the executor between the start
+  and the target of the move
+
+It also reports how many steps per second make it through the queue. The executor's clock is
+simulated and never waits for real time, so this is the most the planner and the queue can keep
+up with on this machine, not a stepping rate.
+Returns non-zero if any check fails.
+*/
+
+#include <kissStepper.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+
+static const uint16_t MAX_SPEED = 20000;
+static const uint16_t ACCEL = 20000;
+static const uint16_t MOVE_COUNT = 100;
+static const int32_t MAX_MOVE = 5000;
+static const uint16_t STOP_COUNT = 20;
+static const int32_t STOPPED_MOVE = 50000;
+static const int TIMEOUT_SECONDS = 120;
+
+static kissSegmentQueue queue;
+static kissStepperPlanner planner(queue);
+static kissStepperExecutor executor(queue, PIN_DIR, PIN_STEP, PIN_ENABLE);
+
+static std::atomic<bool> running(true);
+static uint32_t failures = 0;
+
+typedef std::chrono::steady_clock clock_type;
+
+// ----------------------------------------------------------------------------------------------------
+// Second thread: step the motor
+// ----------------------------------------------------------------------------------------------------
+
+static void runExecutor(void)
+{
+    // coarser simulated time, so the test doesn't spend most of its time polling between steps
+    hostTimeStep = 10;
+    executor.begin();
+    while (running)
+    {
+        // let the planner in whenever the executor is waiting for it, in case both threads share
+        // one processor
+        executor.move();
+        if (queue.isEmpty()) std::this_thread::yield();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Main thread: plan moves and watch the executor
+// ----------------------------------------------------------------------------------------------------
+
+static void fail(const char *what, long long expected, long long actual)
+{
+    printf("FAIL: %s (expected %lld, got %lld)\n", what, expected, actual);
+    failures++;
+}
+
+// plans a move, checking every position read while waiting for room in the queue
+static void planMove(kissPos_t target, kissPos_t lowest, kissPos_t highest, bool forwardsOnly)
+{
+    planner.prepareMove(target);
+    kissPos_t lastPos = executor.getPos();
+    while (planner.plan() != STATE_STOPPED)
+    {
+        kissPos_t pos = executor.getPos();
+        if ((pos < lowest) || (pos > highest))
+            fail("position out of range", target, pos);
+        if (forwardsOnly && (pos < lastPos))
+            fail("position went backwards", lastPos, pos);
+        lastPos = pos;
+        std::this_thread::yield();
+    }
+}
+
+// waits for the executor to finish every queued step, then checks it agrees with the planner
+static void waitForExecutor(void)
+{
+    clock_type::time_point start = clock_type::now();
+    while (executor.getState() != STATE_STOPPED)
+    {
+        if (clock_type::now() - start > std::chrono::seconds(TIMEOUT_SECONDS))
+        {
+            fail("executor never stopped", STATE_STOPPED, executor.getState());
+            running = false;
+            return;
+        }
+        std::this_thread::yield();
+    }
+    if (executor.getPos() != planner.getPos())
+        fail("executor position once stopped", planner.getPos(), executor.getPos());
+}
+
+// starts long moves and stops them from this thread once the executor is under way
+static uint64_t checkPlannerStop(void)
+{
+    uint64_t totalSteps = 0;
+    for (uint16_t i = 0; (i < STOP_COUNT) && running; i++)
+    {
+        kissPos_t from = planner.getPos();
+        kissPos_t target = (i & 1) ? (from - STOPPED_MOVE) : (from + STOPPED_MOVE);
+        kissPos_t stopAfter = 1 + (rand() % (STOPPED_MOVE / 2));
+        if (!planner.prepareMove(target))
+        {
+            fail("prepareMove() after a stop", 1, 0);
+            return totalSteps;
+        }
+        kissPos_t moved = 0;
+        while (moved < stopAfter)
+        {
+            planner.plan();
+            kissPos_t pos = executor.getPos();
+            moved = (pos > from) ? (pos - from) : (from - pos);
+            std::this_thread::yield();
+        }
+        planner.stop();
+
+        clock_type::time_point start = clock_type::now();
+        while (executor.getState() != STATE_STOPPED)
+        {
+            if (clock_type::now() - start > std::chrono::seconds(TIMEOUT_SECONDS))
+            {
+                fail("executor never stopped after planner.stop()", STATE_STOPPED, executor.getState());
+                running = false;
+                return totalSteps;
+            }
+            std::this_thread::yield();
+        }
+        kissPos_t pos = executor.getPos();
+        if ((pos < from - STOPPED_MOVE) || (pos > from + STOPPED_MOVE) || (pos == from))
+            fail("position after planner.stop()", target, pos);
+        planner.setPos(pos);
+        totalSteps += (pos > from) ? (pos - from) : (from - pos);
+    }
+    return totalSteps;
+}
+
+int main(void)
+{
+    planner.setMaxSpeed(MAX_SPEED);
+    planner.setAccel(ACCEL);
+    srand(1);
+
+    std::thread executorThread(runExecutor);
+    clock_type::time_point start = clock_type::now();
+    uint64_t totalSteps = 0;
+
+    // forwards only, so the position must never decrease
+    kissPos_t target = 0;
+    for (uint16_t i = 0; (i < MOVE_COUNT) && running; i++)
+    {
+        kissPos_t from = target;
+        target += 1 + (rand() % MAX_MOVE);
+        planMove(target, 0, target, true);
+        totalSteps += target - from;
+        if ((i % 8) == 7) waitForExecutor();
+    }
+    waitForExecutor();
+
+    // back and forth, waiting for the executor after every other move
+    kissPos_t home = target;
+    for (uint16_t i = 0; (i < MOVE_COUNT) && running; i++)
+    {
+        kissPos_t from = target;
+        target = home + (rand() % (2 * MAX_MOVE + 1)) - MAX_MOVE;
+        planMove(target, home - MAX_MOVE, home + MAX_MOVE, false);
+        totalSteps += (target > from) ? (target - from) : (from - target);
+        if (i & 1) waitForExecutor();
+    }
+    waitForExecutor();
+
+    // stopped part way, then back to where the planner thinks the motor is
+    totalSteps += checkPlannerStop();
+    planMove(home, KISS_POS_MIN, KISS_POS_MAX, false);
+    waitForExecutor();
+
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    running = false;
+    executorThread.join();
+
+    printf("kissPos_t: %u bits, queue: %u segments\n", (unsigned)(sizeof(kissPos_t) * 8), (unsigned)KISS_SEGMENT_QUEUE_SIZE);
+    printf("%llu steps in %.2f s, %.0f steps/s through the queue\n", (unsigned long long)totalSteps, seconds, totalSteps / seconds);
+
+    if (failures)
+    {
+        printf("%u checks FAILED\n", (unsigned)failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+Compares the cost and accuracy of the ramp approximations selectable with setRamp(), on a PC.
+The same measurements as examples/RampBenchmark, without the board. For each approximation, and
+each speed/acceleration pair below, it reports:
+- nanoseconds per ramp step, for the approximation alone (a loop doing everything else is timed
+  separately and subtracted)
+- the worst velocity error over the ramp, compared with the exact formula
+- the velocity error at the end of the ramp
+
+The whole ramp is always checked. Timings are for this machine, and only worth comparing with
+each other; run examples/RampBenchmark for the cost on a board.
+*/
+
+#include <kissStepper.h>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+
+static const uint32_t ONE_SECOND = 1000000UL;
+
+static const uint16_t SPEEDS[] = {400, 1600, 6400, 25600, 65535};
+static const uint16_t ACCELS[] = {1600, 6400, 25600, 65535};
+static const kissRamp_t RAMPS[] = {RAMP_FAST, RAMP_BETTER, RAMP_BEST};
+static const char *const RAMP_NAMES[] = {"RAMP_FAST  ", "RAMP_BETTER", "RAMP_BEST  "};
+
+static const uint32_t TIMED_STEPS = 5000000UL;
+
+// ----------------------------------------------------------------------------------------------------
+// Times TIMED_STEPS ramp steps, repeating the ramp as needed, and returns nanoseconds
+// With approximate = false, the approximation is left out to time everything else
+// ----------------------------------------------------------------------------------------------------
+
+static double timeRamp(kissRamp_t ramp, bool approximate, float firstStepInterval, float topSpeedStepInterval, float constMult, uint32_t accelDist)
+{
+    uint32_t steps = 0;
+    volatile float sink = firstStepInterval;
+    float stepInterval;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    while (steps < TIMED_STEPS)
+    {
+        stepInterval = firstStepInterval;
+        for (uint32_t n = 1; (n < accelDist) && (steps < TIMED_STEPS); n++, steps++)
+        {
+            if (approximate)
+                stepInterval = kissAccelStep(stepInterval, constMult, ramp);
+            else
+                stepInterval = sink;
+            if (stepInterval < topSpeedStepInterval) stepInterval = topSpeedStepInterval;
+        }
+        sink = stepInterval;
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Walks through an acceleration ramp the same way kissStepper does, comparing against the exact speed
+// ----------------------------------------------------------------------------------------------------
+
+static void testRamp(uint8_t r, uint16_t maxSpeed, uint16_t accel)
+{
+    kissRamp_t ramp = RAMPS[r];
+    float constMult = ((float)accel / ONE_SECOND) / ONE_SECOND;
+    float minSpeed = sqrt(2.0 * accel);
+    float topSpeedStepInterval = ONE_SECOND / (float)maxSpeed;
+    uint32_t accelDist = ((uint32_t)maxSpeed * maxSpeed) / (2UL * accel);
+    if (accelDist < 2) accelDist = 2;
+
+    // accuracy
+    float stepInterval = ONE_SECOND / minSpeed;
+    float maxError = 0;
+    float error = 0;
+    for (uint32_t n = 1; n < accelDist; n++)
+    {
+        stepInterval = kissAccelStep(stepInterval, constMult, ramp);
+        if (stepInterval < topSpeedStepInterval) stepInterval = topSpeedStepInterval;
+
+        // after n+1 steps from rest, the exact speed is sqrt(2*a*(n+1))
+        float exactSpeed = sqrt(2.0 * accel * (n + 1));
+        if (exactSpeed > maxSpeed) exactSpeed = maxSpeed;
+        float speed = ONE_SECOND / stepInterval;
+        error = fabs(speed - exactSpeed) / exactSpeed;
+        if (error > maxError) maxError = error;
+    }
+
+    // cost, timed over the same ramp, less the cost of the loop around the approximation
+    double elapsed = timeRamp(ramp, true, ONE_SECOND / minSpeed, topSpeedStepInterval, constMult, accelDist);
+    double overhead = timeRamp(ramp, false, ONE_SECOND / minSpeed, topSpeedStepInterval, constMult, accelDist);
+    elapsed = (elapsed > overhead) ? (elapsed - overhead) : 0;
+
+    printf("%s  speed %5u  accel %5u  ramp steps %7lu  ns/step %6.2f  max error %% %8.4f  final error %% %8.4f\n", RAMP_NAMES[r], maxSpeed, accel, (unsigned long)accelDist, elapsed / TIMED_STEPS, maxError * 100.0, error * 100.0);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(SPEEDS) / sizeof(SPEEDS[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(ACCELS) / sizeof(ACCELS[0]); j++)
+        {
+            for (uint8_t r = 0; r < sizeof(RAMPS) / sizeof(RAMPS[0]); r++)
+                testRamp(r, SPEEDS[i], ACCELS[j]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+Checks resonance avoidance by simulating a springy load.
+
+Input shaping: the load is modelled as a damped oscillator (damping ratio 0.05) on a spring,
+dragged along by the motor's steps. Each move is made with and without a ZV shaper tuned to the
+oscillator, and the ringing left over once the motor stops is compared. Shaped moves must leave
+less than half the ringing of unshaped ones.
+
+Speed bands: moves whose max speed falls inside a band must run below the band instead, with or
+without acceleration. A move stopped early with decelerate() must take about as long to stop as the
+ramp down through the band, boosted, and must not crawl to a stop at the minimum speed.
+
+Returns non-zero if any check fails.
+*/
+
+#include <kissStepper.h>
+#include "hostMove.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+
+static const float DAMPING = 0.05;
+
+struct shaperCase_t
+{
+    float frequency;
+    uint16_t accel;
+    uint16_t speed;
+    kissRamp_t ramp;
+    int32_t target;
+};
+
+static const shaperCase_t SHAPER_CASES[] = {
+    {4, 16000, 10000, RAMP_FAST, 20000},
+    {4, 16000, 10000, RAMP_FAST, 60000},
+    {15, 40000, 25000, RAMP_BEST, 60000},
+    {15, 40000, 25000, RAMP_BEST, 200000},
+};
+
+struct bandCase_t
+{
+    uint16_t lowSpeed;
+    uint16_t highSpeed;
+    uint16_t speed;
+    uint16_t accel;
+    int32_t target;
+};
+
+static const bandCase_t BAND_CASES[] = {
+    {1000, 1500, 1200, 3200, 20000},
+    {1000, 1500, 3200, 3200, 20000},
+    {2, 100, 50, 1000, 5},
+    {1000, 1500, 1200, 0, 2000},
+};
+
+static uint32_t failures = 0;
+
+/* ----------------------------------------------------------------------------------------------------
+Drives a damped oscillator with the step times, in 1 us increments, and returns the amplitude of its
+ringing (in steps) once the motor has stopped.
+    x'' = -w^2 * (x - u) - 2 * damping * w * x'
+where u is the motor position and x the load position.
+---------------------------------------------------------------------------------------------------- */
+
+static double residual(const std::vector<hostStep_t> &steps, double frequency)
+{
+    const double dt = 1e-6;
+    double w = 2.0 * M_PI * frequency;
+    double x = 0;
+    double v = 0;
+    size_t u = 0;
+    uint32_t end = steps.empty() ? 0 : steps.back().time;
+    for (uint32_t t = 0; t <= end; t++)
+    {
+        while ((u < steps.size()) && (steps[u].time <= t)) u++;
+        v += (-w * w * (x - u) - 2.0 * DAMPING * w * v) * dt;
+        x += v * dt;
+    }
+
+    // amplitude of the free oscillation from here on
+    double e = x - u;
+    double wd = w * sqrt(1.0 - DAMPING * DAMPING);
+    double s = (v + DAMPING * w * e) / wd;
+    return sqrt(e * e + s * s);
+}
+
+static void checkShaper(const shaperCase_t &c)
+{
+    kissStepper motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+    motor.setMaxSpeed(c.speed);
+    motor.setAccel(c.accel);
+    motor.setRamp(c.ramp);
+
+    double amplitude[2];
+    for (uint8_t shaped = 0; shaped < 2; shaped++)
+    {
+        kissResonance resonance;
+        if (shaped) resonance.setShaper(c.frequency, DAMPING);
+        motor.setResonance(&resonance);
+        motor.setPos(0);
+        kissStepTrace trace;
+        std::vector<hostStep_t> steps;
+        runMove(motor, c.target, trace, &steps);
+        motor.setResonance(NULL);
+        amplitude[shaped] = residual(steps, c.frequency);
+        if (motor.getPos() != c.target)
+        {
+            printf("FAIL: ended at %ld instead of %ld\n", (long)motor.getPos(), (long)c.target);
+            failures++;
+        }
+    }
+
+    bool ok = (amplitude[1] < amplitude[0] / 2);
+    printf("%s: %.0f Hz, accel %u, speed %u, ramp %u, %ld steps: residual %.3f unshaped, %.3f shaped\n", ok ? "ok" : "FAIL", c.frequency, c.accel, c.speed, (unsigned)c.ramp, (long)c.target, amplitude[0], amplitude[1]);
+    if (!ok) failures++;
+}
+
+static void checkBand(const bandCase_t &c)
+{
+    kissStepper motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+    motor.setMaxSpeed(c.speed);
+    motor.setAccel(c.accel);
+    kissResonance resonance;
+    resonance.addSpeedBand(c.lowSpeed, c.highSpeed);
+    motor.setResonance(&resonance);
+
+    kissStepTrace trace;
+    std::vector<hostStep_t> steps;
+    runMove(motor, c.target, trace, &steps);
+
+    // the motor may pass through the band while accelerating or decelerating, but not run in it
+    uint32_t fastestRun = 0;
+    bool ok = (motor.getPos() == c.target);
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        if (steps[i].entry.state != STATE_RUN) continue;
+        uint32_t speed = 1000000UL / steps[i].entry.interval;
+        if (speed > fastestRun) fastestRun = speed;
+        if ((speed >= c.lowSpeed) && (speed <= c.highSpeed)) ok = false;
+    }
+    printf("%s: band %u-%u Hz, max speed %u: ran at up to %lu Hz\n", ok ? "ok" : "FAIL", c.lowSpeed, c.highSpeed, c.speed, (unsigned long)fastestRun);
+    if (!ok) failures++;
+}
+
+static void checkBandDecel(void)
+{
+    const uint16_t SPEED = 3200;
+    const uint16_t ACCEL = 3200;
+    const uint16_t LOW_SPEED = 1000;
+    const uint16_t HIGH_SPEED = 1500;
+    // a little slower than the first step of the ramp
+    const uint32_t SLOW_INTERVAL = 8000;
+
+    kissStepper motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+    motor.setMaxSpeed(SPEED);
+    motor.setAccel(ACCEL);
+    kissResonance resonance;
+    resonance.addSpeedBand(LOW_SPEED, HIGH_SPEED);
+    motor.setResonance(&resonance);
+    kissStepTrace trace;
+    motor.setTrace(&trace);
+
+    motor.prepareMove(20000);
+    while (motor.move() != STATE_RUN);
+    uint32_t start = hostTime;
+    uint32_t stepsBefore = trace.getTotal();
+    motor.decelerate();
+    uint32_t slowSteps = 0;
+    kissState_t state;
+    do
+    {
+        state = motor.move();
+        if ((trace.getTotal() > stepsBefore) && (trace.getEntry(trace.getCount() - 1).interval > SLOW_INTERVAL)) slowSteps++;
+        stepsBefore = trace.getTotal();
+    } while (state != STATE_STOPPED);
+    motor.setTrace(NULL);
+
+    // the unboosted ramp down, less the time saved crossing the band at the boosted acceleration
+    float boost = resonance.getBandBoost();
+    float bandTime = (float)(HIGH_SPEED - LOW_SPEED) / ACCEL;
+    float expected = (float)SPEED / ACCEL - bandTime + bandTime / boost;
+    float taken = (hostTime - start) / 1e6;
+    bool ok = (taken > expected * 0.9) && (taken < expected * 1.05) && (slowSteps <= 2);
+    printf("%s: band %u-%u Hz, decelerating from %u Hz: stopped in %.2f s (expected %.2f s), %lu steps slower than %lu Hz\n", ok ? "ok" : "FAIL", LOW_SPEED, HIGH_SPEED, SPEED, taken, expected, (unsigned long)slowSteps, 1000000UL / SLOW_INTERVAL);
+    if (!ok) failures++;
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(SHAPER_CASES) / sizeof(SHAPER_CASES[0]); i++)
+        checkShaper(SHAPER_CASES[i]);
+    for (size_t i = 0; i < sizeof(BAND_CASES) / sizeof(BAND_CASES[0]); i++)
+        checkBand(BAND_CASES[i]);
+    checkBandDecel();
+
+    // a band must leave room below it
+    kissResonance resonance;
+    if (resonance.addSpeedBand(1, 100))
+    {
+        printf("FAIL: a band starting at 1 Hz was accepted\n");
+        failures++;
+    }
+
+    if (failures)
+    {
+        printf("%u checks FAILED\n", (unsigned)failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
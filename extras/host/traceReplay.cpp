@@ -0,0 +1,251 @@
+/*
+Replays a move through this build of the library and compares it with a recorded step trace.
+
+    traceReplay [options] [trace file]
+
+Options describe the move, and must match the settings the trace was recorded with:
+    -t target     target position, starting from 0 (default 1600)
+    -s speed      max speed in Hz (default 1600)
+    -a accel      acceleration in Hz/s (default 1600)
+    -r ramp       0 = RAMP_FAST, 1 = RAMP_BETTER, 2 = RAMP_BEST (default 0)
+    -n            no acceleration (kissStepperNoAccel)
+    -k tolerance  allowed difference between intervals, in microseconds (default 0)
+
+With a trace file (the output of kissStepTrace::dump(), "-" for standard input), the state and
+interval of every step in the trace are compared with the same step of the replayed move. Traces
+that only hold the end of a move are lined up using their step total. Returns non-zero if the
+number of steps or any step differs.
+
+Without a trace file, the replayed move is dumped with kissStepTrace::dump(), so it can be saved
+from one build of the library and compared against another.
+
+The replay is recorded by a kissStepTrace too, so the Makefile builds this program with a
+KISS_TRACE_SIZE of 32768. Moves longer than that are only compared over their last 32768 steps.
+
+AVR boards do all floating point math in single precision, so a trace recorded on one may differ
+from this build by a microsecond on some steps. Use -k 1 to allow for that.
+*/
+
+#include <kissStepper.h>
+#include <Print.h>
+#include "hostMove.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const uint8_t PIN_DIR = 3;
+static const uint8_t PIN_STEP = 4;
+static const uint8_t PIN_ENABLE = 7;
+
+static const uint16_t MAX_REPORTED = 20;
+
+struct settings_t
+{
+    kissPos_t target;
+    uint16_t speed;
+    uint16_t accel;
+    kissRamp_t ramp;
+    bool noAccel;
+    uint32_t tolerance;
+};
+
+// ----------------------------------------------------------------------------------------------------
+// Replaying
+// ----------------------------------------------------------------------------------------------------
+
+// too big for the stack with a large KISS_TRACE_SIZE
+static kissStepTrace trace;
+
+static void replay(const settings_t &settings)
+{
+    if (settings.noAccel)
+    {
+        kissStepperNoAccel motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+        motor.setMaxSpeed(settings.speed);
+        runMove(motor, settings.target, trace);
+    }
+    else
+    {
+        kissStepper motor(PIN_DIR, PIN_STEP, PIN_ENABLE);
+        motor.setMaxSpeed(settings.speed);
+        motor.setAccel(settings.accel);
+        motor.setRamp(settings.ramp);
+        runMove(motor, settings.target, trace);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Reading a trace
+// ----------------------------------------------------------------------------------------------------
+
+// skips anything before the header, and stops at the first line that isn't a step
+static bool readTrace(FILE *file, uint32_t &total, std::vector<kissTraceEntry_t> &steps)
+{
+    char line[128];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file))
+        found = (strncmp(line, "kissStepTrace v1", 16) == 0);
+    if (!found) return false;
+
+    unsigned long steps_total;
+    if (!fgets(line, sizeof(line), file) || (sscanf(line, "steps,%lu", &steps_total) != 1)) return false;
+    total = steps_total;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned int state;
+        unsigned long interval;
+        if (sscanf(line, "%u,%lu,", &state, &interval) != 2) break;
+        kissTraceEntry_t entry;
+        entry.state = (kissState_t)state;
+        entry.interval = interval;
+        entry.timeDelta = kissStepTrace::NO_TIME_DELTA;
+        steps.push_back(entry);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+static int compare(const std::vector<kissTraceEntry_t> &recorded, uint32_t recordedTotal, const std::vector<kissTraceEntry_t> &replayed, uint32_t replayedTotal, uint32_t tolerance)
+{
+    int result = 0;
+    if (recordedTotal != replayedTotal)
+    {
+        printf("step count differs: trace %lu, this build %lu\n", (unsigned long)recordedTotal, (unsigned long)replayedTotal);
+        result = 1;
+    }
+    if (recorded.size() > recordedTotal)
+    {
+        printf("trace holds more steps than its total\n");
+        return 1;
+    }
+
+    // both traces may only hold the end of their move, so line them up by step number
+    uint32_t first = recordedTotal - recorded.size();
+    uint32_t replayedFirst = replayedTotal - replayed.size();
+    uint32_t compared = 0;
+    uint32_t differences = 0;
+    for (uint32_t i = 0; i < recorded.size(); i++)
+    {
+        uint32_t step = first + i;
+        if (step < replayedFirst) continue;
+        if (step >= replayedTotal) break;
+        const kissTraceEntry_t &a = recorded[i];
+        const kissTraceEntry_t &b = replayed[step - replayedFirst];
+        compared++;
+        uint32_t intervalDiff = (a.interval > b.interval) ? (a.interval - b.interval) : (b.interval - a.interval);
+        if ((a.state != b.state) || (intervalDiff > tolerance))
+        {
+            if (differences < MAX_REPORTED)
+                printf("step %lu: trace %u,%lu  this build %u,%lu\n", (unsigned long)step, (unsigned)a.state, (unsigned long)a.interval, (unsigned)b.state, (unsigned long)b.interval);
+            differences++;
+        }
+    }
+    if (differences > MAX_REPORTED) printf("...\n");
+    printf("%lu of %lu steps in the trace differ (steps %lu to %lu of %lu)\n", (unsigned long)differences, (unsigned long)compared, (unsigned long)first, (unsigned long)(first + recorded.size()), (unsigned long)recordedTotal);
+    if (differences) result = 1;
+    return result;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: traceReplay [-t target] [-s speed] [-a accel] [-r ramp] [-n] [-k tolerance] [trace file]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    settings_t settings;
+    settings.target = 1600;
+    settings.speed = 1600;
+    settings.accel = 1600;
+    settings.ramp = RAMP_FAST;
+    settings.noAccel = false;
+    settings.tolerance = 0;
+    const char *fileName = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-n") == 0)
+            settings.noAccel = true;
+        else if ((arg[0] == '-') && arg[1] && !arg[2] && (i + 1 < argc))
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            switch (arg[1])
+            {
+            case 't':
+                settings.target = value;
+                break;
+            case 's':
+                settings.speed = value;
+                break;
+            case 'a':
+                settings.accel = value;
+                break;
+            case 'r':
+                if ((value < RAMP_FAST) || (value > RAMP_BEST)) usage();
+                settings.ramp = (kissRamp_t)value;
+                break;
+            case 'k':
+                settings.tolerance = value;
+                break;
+            default:
+                usage();
+            }
+        }
+        else if (!fileName)
+            fileName = arg;
+        else
+            usage();
+    }
+
+    replay(settings);
+
+    if (!fileName)
+    {
+        FilePrint out(stdout);
+        trace.dump(out);
+        return 0;
+    }
+
+    FILE *file = (strcmp(fileName, "-") == 0) ? stdin : fopen(fileName, "r");
+    if (!file)
+    {
+        fprintf(stderr, "can't open %s\n", fileName);
+        return 2;
+    }
+    uint32_t recordedTotal;
+    std::vector<kissTraceEntry_t> recorded;
+    bool ok = readTrace(file, recordedTotal, recorded);
+    if (file != stdin) fclose(file);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a kissStepTrace v1 dump\n", fileName);
+        return 2;
+    }
+
+    // read the replay back through the same dump format
+    FILE *dumpFile = tmpfile();
+    if (!dumpFile)
+    {
+        fprintf(stderr, "can't create a temporary file\n");
+        return 2;
+    }
+    FilePrint out(dumpFile);
+    trace.dump(out);
+    rewind(dumpFile);
+    uint32_t replayedTotal;
+    std::vector<kissTraceEntry_t> replayed;
+    ok = readTrace(dumpFile, replayedTotal, replayed);
+    fclose(dumpFile);
+    if (!ok)
+    {
+        fprintf(stderr, "can't read back the replayed trace\n");
+        return 2;
+    }
+    return compare(recorded, recordedTotal, replayed, replayedTotal, settings.tolerance);
+}
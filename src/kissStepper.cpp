@@ -23,6 +23,9 @@ Optimization notes:
 
 #include "kissStepper.h"
 
+// see the link-time check of the build options in kissStepper.h
+const uint8_t KISS_CONFIG_SYMBOL = 0;
+
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
@@ -43,6 +46,7 @@ kissStepperNoAccel::kissStepperNoAccel(uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_
     m_distMoved(0),
     m_forwards(false),
     m_pos(0),
+    m_posGeneration(0),
     m_stepBit(digitalPinToBitMask(PIN_STEP)),
     m_stepOut(portOutputRegister(digitalPinToPort(PIN_STEP))),
     m_stepIntervalWhole(0),
@@ -51,7 +55,18 @@ kissStepperNoAccel::kissStepperNoAccel(uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_
     m_enabled(false),
     m_lastStepTime(0),
     m_invertDir(invertDir),
-    m_init(false)
+    m_init(false),
+    m_reducePin(255),
+    m_currentReduced(false),
+    m_idleConfig(0),
+    m_idleActions(0),
+    m_stopTime(0),
+    m_reduceDelay(0),
+    m_disableDelay(0),
+    m_waking(false),
+    m_wakeDelay(0),
+    m_wakeTime(0),
+    m_trace(NULL)
 {}
 
 kissStepperNoAccel::kissStepperNoAccel(uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir) : kissStepperNoAccel(PIN_DIR, PIN_STEP, 255, invertDir) {}
@@ -86,7 +101,16 @@ void kissStepperNoAccel::begin(void)
 
 void kissStepperNoAccel::enable(void)
 {
+    // start timing the wake up, see isAwake()
+    if (!m_enabled || m_currentReduced)
+    {
+        m_wakeTime = micros();
+        m_waking = true;
+    }
     if (PIN_ENABLE != 255) digitalWrite(PIN_ENABLE, LOW);
+    if (m_reducePin != 255) digitalWrite(m_reducePin, LOW);
+    m_currentReduced = false;
+    m_idleActions = 0;
     m_enabled = true;
 }
 
@@ -97,14 +121,69 @@ void kissStepperNoAccel::disable(void)
 {
     stop();
     if (PIN_ENABLE != 255) digitalWrite(PIN_ENABLE, HIGH);
+    m_idleActions = 0;
     m_enabled = false;
 }
 
+/* ----------------------------------------------------------------------------------------------------
+Disables the motor controller once the motor has been stopped for holdTime milliseconds.
+A holdTime of 0 keeps the motor controller enabled (the default).
+---------------------------------------------------------------------------------------------------- */
+
+void kissStepperNoAccel::setAutoDisable(uint16_t holdTime)
+{
+    m_disableDelay = holdTime * 1000UL;
+    if (holdTime > 0)
+        m_idleConfig |= IDLE_DISABLE;
+    else
+        m_idleConfig &= ~IDLE_DISABLE;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Drives pin HIGH once the motor has been stopped for reduceTime milliseconds, and LOW again when the
+motor controller is enabled for the next move. Use with drivers that have a current reduction input.
+A pin of 255 removes the reduced current pin.
+---------------------------------------------------------------------------------------------------- */
+
+void kissStepperNoAccel::setReducedCurrentPin(uint8_t pin, uint16_t reduceTime)
+{
+    if (m_reducePin != 255) digitalWrite(m_reducePin, LOW);
+    m_reducePin = pin;
+    m_reduceDelay = reduceTime * 1000UL;
+    m_currentReduced = false;
+    if (pin != 255)
+    {
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, LOW);
+        m_idleConfig |= IDLE_REDUCE;
+    }
+    else
+        m_idleConfig &= ~IDLE_REDUCE;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Carries out pending idle actions whose time has come. Only called by move() while stopped and
+while there are actions pending.
+---------------------------------------------------------------------------------------------------- */
+
+void kissStepperNoAccel::idle(uint32_t curTime)
+{
+    uint32_t idleTime = curTime - m_stopTime;
+    if ((m_idleActions & IDLE_REDUCE) && (idleTime >= m_reduceDelay))
+    {
+        digitalWrite(m_reducePin, HIGH);
+        m_currentReduced = true;
+        m_idleActions &= ~IDLE_REDUCE;
+    }
+    if ((m_idleActions & IDLE_DISABLE) && (idleTime >= m_disableDelay))
+        disable();
+}
+
 // ----------------------------------------------------------------------------------------------------
 // Does some basic checks, enforces limits, calculates the step interval, and switches to STATE_STARTING
 // ----------------------------------------------------------------------------------------------------
 
-bool kissStepperNoAccel::prepareMove(int32_t target)
+bool kissStepperNoAccel::prepareMove(kissPos_t target)
 {
 
     if (!m_init) begin();
@@ -114,13 +193,14 @@ bool kissStepperNoAccel::prepareMove(int32_t target)
     {
         // constrain the target between reverseLimit and forwardLimit
         target = constrain(target, m_reverseLimit, m_forwardLimit);
+        target = kissLimitMove(target, m_pos);
 
         // only continue if movement is required (positive distance) and possible (positive speed)
         if ((target != m_pos) && (m_maxSpeed > 0))
         {
 
-            // enable the motor controller if necessary
-            if (!m_enabled) enable();
+            // enable the motor controller and restore full current if necessary
+            wake();
 
             // set the direction
             setDir(target > m_pos);
@@ -181,6 +261,8 @@ kissState_t kissStepperNoAccel::move(void)
 			*m_stepOut ^= m_stepBit;
             interrupts();
 
+            if (m_trace) m_trace->record(curTime, m_kissState, m_stepIntervalWhole);
+
             // adjust position
             m_distMoved++;
 
@@ -191,9 +273,15 @@ kissState_t kissStepperNoAccel::move(void)
     }
     else if (m_kissState == STATE_STARTING)
     {
-        m_lastStepTime = curTime;
-        m_kissState = STATE_RUN;
+        // hold the first step until the motor controller has woken up
+        if (isAwake(curTime, m_stepIntervalWhole))
+        {
+            m_lastStepTime = curTime;
+            m_kissState = STATE_RUN;
+        }
     }
+    else if (m_idleActions)
+        idle(curTime);
 
     return m_kissState;
 }
@@ -205,40 +293,120 @@ void kissStepperNoAccel::stop(void)
 {
     updatePos();
     m_distTotal = 0;
+    if (m_kissState != STATE_STOPPED) startIdle();
     m_kissState = STATE_STOPPED;
 }
 
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
-// kissStepper WITH acceleration
+// Speed profile
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 
-kissStepper::kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_t PIN_ENABLE, bool invertDir) :
-    kissStepperNoAccel(PIN_DIR, PIN_STEP, PIN_ENABLE, invertDir),
+kissRampProfile::kissRampProfile(void) :
+    m_accel(DEFAULT_ACCEL),
+    m_ramp(RAMP_FAST),
+    m_resonance(NULL),
     m_distAccel(0),
     m_distRun(0),
     m_topSpeedStepInterval(0),
     m_minSpeedStepInterval(0),
-    m_stepInterval(0),
-    m_constMult(0),
-    m_accel(DEFAULT_ACCEL)
+    m_constMult(0)
 {}
 
-kissStepper::kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir) : kissStepper(PIN_DIR, PIN_STEP, 255, invertDir) {}
-
 /* ----------------------------------------------------------------------------------------------------
-Does some basic checks, enforces limits, calculates the step interval, and switches to STATE_STARTING.
+Calculates the distance for acceleration (distAccel) and constant velocity (distRun) of a move of
+distTotal steps, and the step intervals at its start and at top speed.
 
-This method also calculates the distance for acceleration (distAccel), constant velocity (distRun),
-and total distance (distTotal).
+The distances are the cumulative number of step pin pulses produced before it's time to change state.
+Sets stepIntervalRemainder for the interval correction at top speed, and returns the interval of the
+first step.
+---------------------------------------------------------------------------------------------------- */
+
+float kissRampProfile::calcProfile(uint32_t distTotal, uint16_t maxSpeed, uint16_t &stepIntervalRemainder)
+{
+    const uint32_t ONE_SECOND = 1000000UL;
+    float minSpeed;
+    uint16_t topSpeed;
 
-The values are the cumulative number of step pin pulses produced before it's time to change state.
+    // calculate distance for accel/decel
+    // this is the distance of accel/decel between 0 st/s and maxSpeed
+    uint32_t maxDist = maxAccelDist(maxSpeed);
+
+    // if maxDist >= half the total distance, use a triangular speed profile (accelerate then decelerate)
+    // otherwise use a trapezoidal profile (accelerate, then run, then decelerate)
+    if ((maxDist >= (distTotal / 2)) && (m_accel > 0))
+    {
+        // triangular profile, top speed is likely to be different than max speed
+        m_distAccel = distTotal / 2;
+        m_distRun = m_distAccel;
+
+        // displacement equation: d = a*t*t / 2; t = sqrt(2*d / a)
+        // topSpeed = a*t = a * sqrt(2d/a)
+        topSpeed = m_accel * sqrt((2.0 * m_distAccel) / m_accel);
+    }
+    else
+    {
+        // trapezoidal or flat profile, top speed will be equal to max speed
+        m_distAccel = maxDist;
+        m_distRun = distTotal - m_distAccel;
+        topSpeed = maxSpeed;
+    }
+
+    // keep clear of resonant speeds, and make room for input shaping
+    if (m_resonance) m_resonance->adjustProfile(distTotal, m_accel, topSpeed, m_distAccel, m_distRun);
+
+    // calculate constant multiplier
+    m_constMult = ((float)m_accel / ONE_SECOND) / ONE_SECOND;
+
+    // calculate min speed (for initial step delay)
+    // min speed = sqrt(V0^2 + 2a)
+    // because initial velocity is 0:
+    // min speed = sqrt(2a)
+    if (m_accel > 0)
+        minSpeed = sqrt(2.0 * m_accel);
+    else
+        minSpeed = maxSpeed;
+
+    // a low max speed, or one lowered to keep below a speed band, can be slower than that
+    if ((topSpeed > 0) && (topSpeed < minSpeed)) minSpeed = topSpeed;
+
+    // a one step move has no acceleration distance, and so no top speed
+    if (topSpeed == 0) topSpeed = 1;
+
+    // calculate step interval at top speed
+    m_topSpeedStepInterval = ONE_SECOND / topSpeed;
+    stepIntervalRemainder = ONE_SECOND % topSpeed;
+
+    // calculate step interval at min speed (initial step delay)
+    float minSpeedStepInterval = ONE_SECOND / minSpeed;
+    m_minSpeedStepInterval = minSpeedStepInterval;
+    return minSpeedStepInterval;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// kissStepper WITH acceleration
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+kissStepper::kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_t PIN_ENABLE, bool invertDir) :
+    kissStepperNoAccel(PIN_DIR, PIN_STEP, PIN_ENABLE, invertDir),
+    m_stepInterval(0)
+{}
+
+kissStepper::kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir) : kissStepper(PIN_DIR, PIN_STEP, 255, invertDir) {}
+
+/* ----------------------------------------------------------------------------------------------------
+Does some basic checks, enforces limits, calculates the speed profile (see kissRampProfile::calcProfile()),
+and switches to STATE_STARTING.
 ---------------------------------------------------------------------------------------------------- */
 
-bool kissStepper::prepareMove(int32_t target)
+bool kissStepper::prepareMove(kissPos_t target)
 {
 
     if (!m_init) begin();
@@ -248,16 +416,14 @@ bool kissStepper::prepareMove(int32_t target)
     {
         // constrain the target between reverseLimit and forwardLimit
         target = constrain(target, m_reverseLimit, m_forwardLimit);
+        target = kissLimitMove(target, m_pos);
 
         // only continue if movement is required (positive distance) and possible (positive speed)
         if ((target != m_pos) && (m_maxSpeed > 0))
         {
 
-            float minSpeed;
-            uint16_t topSpeed;
-
-            // enable the motor controller if necessary
-            if (!m_enabled) enable();
+            // enable the motor controller and restore full current if necessary
+            wake();
 
             // set the direction
             setDir(target > m_pos);
@@ -268,50 +434,10 @@ bool kissStepper::prepareMove(int32_t target)
             // calculate total distance
             m_distTotal = (target > m_pos) ? (target - m_pos) : (m_pos - target);
 
-            // calculate distance for accel/decel
-            // this is the distance of accel/decel between 0 st/s and maxSpeed
-            uint32_t maxAccelDist = calcMaxAccelDist();
-
-            // if maxAccelDist >= half the total distance, use a triangular speed profile (accelerate then decelerate)
-            // otherwise use a trapezoidal profile (accelerate, then run, then decelerate)
-            if ((maxAccelDist >= (m_distTotal / 2)) && (m_accel > 0))
-            {
-                // triangular profile, top speed is likely to be different than max speed
-                m_distAccel = m_distTotal / 2;
-                m_distRun = m_distAccel;
-
-                // displacement equation: d = a*t*t / 2; t = sqrt(2*d / a)
-                // topSpeed = a*t = a * sqrt(2d/a)
-                topSpeed = m_accel * sqrt((2.0 * m_distAccel) / m_accel);
-            }
-            else
-            {
-                // trapezoidal or flat profile, top speed will be equal to max speed
-                m_distAccel = maxAccelDist;
-                m_distRun = m_distTotal - m_distAccel;
-                topSpeed = m_maxSpeed;
-            }
-
-            // calculate constant multiplier
-            m_constMult = ((float)m_accel / ONE_SECOND) / ONE_SECOND;
-
-            // calculate min speed (for initial step delay)
-            // min speed = sqrt(V0^2 + 2a)
-            // because initial velocity is 0:
-            // min speed = sqrt(2a)
-            if (m_accel > 0)
-                minSpeed = sqrt(2.0 * m_accel);
-            else
-                minSpeed = m_maxSpeed;
-
-            // calculate step interval at top speed
-            m_topSpeedStepInterval = ONE_SECOND / topSpeed;
-            m_stepIntervalRemainder = ONE_SECOND % topSpeed;
+            // calculate the speed profile
+            m_stepIntervalWhole = m_stepInterval = calcProfile(m_distTotal, m_maxSpeed, m_stepIntervalRemainder);
             m_stepIntervalCorrectionCounter = 0;
 
-            // calculate step interval at min speed (initial step delay)
-            m_minSpeedStepInterval = m_stepIntervalWhole = m_stepInterval = ONE_SECOND / minSpeed;
-
             return true;
         }
     }
@@ -354,6 +480,8 @@ kissState_t kissStepper::move(void)
             //*m_stepOut = oldStepOut;
             interrupts();
 
+            if (m_trace) m_trace->record(curTime, m_kissState, m_stepIntervalWhole);
+
             // adjust position
             m_distMoved++;
 
@@ -372,7 +500,7 @@ kissState_t kissStepper::move(void)
                     else
                     {
                         m_kissState = STATE_DECEL;
-                        m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval, m_constMult);
+                        m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval);
                     }
                 }
             }
@@ -390,34 +518,40 @@ kissState_t kissStepper::move(void)
                     else
                     {
                         m_kissState = STATE_DECEL;
-                        m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval, m_constMult);
+                        m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval);
                     }
                 }
                 else
-                    m_stepIntervalWhole = m_stepInterval = accelStep(m_stepInterval, m_constMult);
+                    m_stepIntervalWhole = m_stepInterval = accelStep(m_stepInterval);
             }
             else
             {
                 if (m_distMoved == m_distTotal)
                     stop();
                 else
-                    m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval, m_constMult);
+                    m_stepIntervalWhole = m_stepInterval = decelStep(m_stepInterval);
             }
         }
     }
     else if (m_kissState == STATE_STARTING)
     {
-        // start with the first part of the profile with non-zero length
-        m_lastStepTime = curTime;
-        if (m_distAccel != 0)
-            m_kissState = STATE_ACCEL;
-        else if (m_distRun != 0)
-            m_kissState = STATE_RUN;
-        else if (m_distTotal != 0)
-            m_kissState = STATE_DECEL;
-        else // this should never happen... but fail gracefully if it does
-            stop();
+        // hold the first step until the motor controller has woken up
+        if (isAwake(curTime, m_stepIntervalWhole))
+        {
+            // start with the first part of the profile with non-zero length
+            m_lastStepTime = curTime;
+            if (m_distAccel != 0)
+                m_kissState = STATE_ACCEL;
+            else if (m_distRun != 0)
+                m_kissState = STATE_RUN;
+            else if (m_distTotal != 0)
+                m_kissState = STATE_DECEL;
+            else // this should never happen... but fail gracefully if it does
+                stop();
+        }
     }
+    else if (m_idleActions)
+        idle(curTime);
 
     return m_kissState;
 }
@@ -435,11 +569,18 @@ void kissStepper::decelerate(void)
             uint32_t curSpeed = ONE_SECOND / m_stepIntervalWhole;
             uint32_t avgSpeed = curSpeed / 2;
             uint32_t maxDecelDist = (avgSpeed * curSpeed) / m_accel;
+            if (m_resonance)
+            {
+                // boosting through bands on the way down takes fewer steps
+                float savedDist = m_resonance->savedDist(curSpeed, m_accel);
+                maxDecelDist = (savedDist < maxDecelDist) ? (maxDecelDist - savedDist) : 0;
+            }
             uint32_t decelDist = (maxDecelDist > distRemaining) ? distRemaining : maxDecelDist;
             m_distAccel = 0;
             m_distRun = 0;
             m_distTotal = m_distMoved + decelDist;
             m_kissState = STATE_DECEL;
+            if (m_resonance) m_resonance->cancelShaping();
         }
         else
             stop();
@@ -453,6 +594,7 @@ void kissStepper::stop(void)
 {
     updatePos();
     m_distAccel = m_distRun = m_distTotal = 0;
+    if (m_kissState != STATE_STOPPED) startIdle();
     m_kissState = STATE_STOPPED;
 }
 
@@ -466,3 +608,537 @@ uint16_t kissStepper::getTopSpeed(void)
     else
         return 0;
 }
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Split planner/executor
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+kissStepperPlanner::kissStepperPlanner(kissSegmentQueue &queue) :
+    m_queue(queue),
+    m_forwardLimit(DEFAULT_FORWARD_LIMIT),
+    m_reverseLimit(DEFAULT_REVERSE_LIMIT),
+    m_maxSpeed(DEFAULT_SPEED),
+    m_kissState(STATE_STOPPED),
+    m_forwards(true),
+    m_pos(0),
+    m_distTotal(0),
+    m_distPlanned(0),
+    m_stepIntervalRemainder(0),
+    m_stepInterval(0)
+{}
+
+/* ----------------------------------------------------------------------------------------------------
+Calculates the speed profile for a move, with the same kissRampProfile as kissStepper.
+
+Unlike kissStepper, a new move may be prepared as soon as the previous one has been completely
+planned, even if the executor is still working through it. Moves always start and end at rest.
+---------------------------------------------------------------------------------------------------- */
+
+bool kissStepperPlanner::prepareMove(kissPos_t target)
+{
+    // only continue if the previous move has been completely planned, and the executor has dealt
+    // with any stop request
+    if ((m_kissState == STATE_STOPPED) && !m_queue.isStopRequested())
+    {
+        // constrain the target between reverseLimit and forwardLimit
+        target = constrain(target, m_reverseLimit, m_forwardLimit);
+        target = kissLimitMove(target, m_pos);
+
+        // only continue if movement is required (positive distance) and possible (positive speed)
+        if ((target != m_pos) && (m_maxSpeed > 0))
+        {
+
+            m_forwards = (target > m_pos);
+            m_kissState = STATE_STARTING;
+            m_distPlanned = 0;
+
+            // calculate total distance
+            m_distTotal = (target > m_pos) ? (target - m_pos) : (m_pos - target);
+
+            // calculate the speed profile
+            m_stepInterval = calcProfile(m_distTotal, m_maxSpeed, m_stepIntervalRemainder);
+
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Walks through the speed profile, pushing segments into the queue until it is full or the move has
+been completely planned. Call repeatedly while the executor is running.
+Returns STATE_STOPPED once the whole move is in the queue.
+---------------------------------------------------------------------------------------------------- */
+
+kissState_t kissStepperPlanner::plan(void)
+{
+    if (m_kissState == STATE_STARTING)
+    {
+        // start with the first part of the profile with non-zero length
+        if (m_distAccel != 0)
+            m_kissState = STATE_ACCEL;
+        else if (m_distRun != 0)
+        {
+            m_kissState = STATE_RUN;
+            m_stepInterval = m_topSpeedStepInterval;
+        }
+        else
+            m_kissState = STATE_DECEL;
+    }
+
+    kissSegment_t segment;
+    segment.forwards = m_forwards;
+
+    while ((m_kissState > STATE_STARTING) && !m_queue.isFull())
+    {
+        segment.state = m_kissState;
+        segment.interval = m_stepInterval;
+        segment.remainder = 0;
+        segment.steps = 0;
+
+        if (m_kissState == STATE_RUN)
+        {
+            // the whole run is a handful of segments of constant interval
+            uint32_t steps = m_distRun - m_distPlanned;
+            if (steps > MAX_SEGMENT_STEPS) steps = MAX_SEGMENT_STEPS;
+            segment.steps = steps;
+            segment.remainder = m_stepIntervalRemainder;
+            m_distPlanned += steps;
+        }
+        else
+        {
+            // the executor only uses whole microseconds, so ramp steps whose whole interval is the
+            // same share a segment, which keeps the queue from running dry at high speeds
+            uint32_t rampEnd = (m_kissState == STATE_ACCEL) ? m_distAccel : m_distTotal;
+            do
+            {
+                segment.steps++;
+                m_distPlanned++;
+                if (m_distPlanned == rampEnd) break;
+                if (m_kissState == STATE_ACCEL)
+                    m_stepInterval = accelStep(m_stepInterval);
+                else
+                    m_stepInterval = decelStep(m_stepInterval);
+            }
+            while (((uint32_t)m_stepInterval == segment.interval) && (segment.steps < MAX_SEGMENT_STEPS));
+        }
+
+        // the executor stops after the last segment of a move, and waits for more otherwise
+        segment.last = (m_distPlanned == m_distTotal);
+        m_queue.push(segment);
+
+        if (segment.last)
+            finishPlan();
+        else if ((m_kissState == STATE_ACCEL) && (m_distPlanned == m_distAccel))
+        {
+            if (m_distRun != m_distAccel)
+            {
+                m_kissState = STATE_RUN;
+                m_stepInterval = m_topSpeedStepInterval;
+            }
+            else
+            {
+                m_kissState = STATE_DECEL;
+                m_stepInterval = decelStep(m_stepInterval);
+            }
+        }
+        else if ((m_kissState == STATE_RUN) && (m_distPlanned == m_distRun))
+        {
+            m_kissState = STATE_DECEL;
+            m_stepInterval = decelStep(m_stepInterval);
+        }
+    }
+
+    return m_kissState;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Stops planning, and asks the executor to stop the motor and discard the queue, which it does at its
+next move(). Safe while the executor runs on another core or in an interrupt.
+Once the executor's getState() returns STATE_STOPPED, call setPos() with the executor's position to
+resynchronize. New moves can't be prepared until then.
+---------------------------------------------------------------------------------------------------- */
+
+void kissStepperPlanner::stop(void)
+{
+    finishPlan();
+    m_queue.requestStop();
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Ends the current move, the planner's position becomes its target
+// ----------------------------------------------------------------------------------------------------
+
+void kissStepperPlanner::finishPlan(void)
+{
+    if (m_forwards)
+        m_pos += m_distPlanned;
+    else
+        m_pos -= m_distPlanned;
+    m_distAccel = m_distRun = m_distTotal = m_distPlanned = 0;
+    m_kissState = STATE_STOPPED;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+kissStepperExecutor::kissStepperExecutor(kissSegmentQueue &queue, uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_t PIN_ENABLE, bool invertDir) :
+    kissStepperNoAccel(PIN_DIR, PIN_STEP, PIN_ENABLE, invertDir),
+    m_queue(queue),
+    m_lastSegment(true),
+    m_sharedState(STATE_STOPPED)
+{}
+
+kissStepperExecutor::kissStepperExecutor(kissSegmentQueue &queue, uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir) : kissStepperExecutor(queue, PIN_DIR, PIN_STEP, 255, invertDir) {}
+
+// ----------------------------------------------------------------------------------------------------
+// Loads the next segment from the queue, if there is one
+// ----------------------------------------------------------------------------------------------------
+
+bool kissStepperExecutor::nextSegment(void)
+{
+    kissSegment_t segment;
+    if (!m_queue.pop(segment)) return false;
+
+    updatePos();
+    if (segment.forwards != m_forwards) setDir(segment.forwards);
+    m_distTotal = segment.steps;
+    m_stepIntervalWhole = segment.interval;
+    m_stepIntervalRemainder = segment.remainder;
+    m_stepIntervalCorrectionCounter = 0;
+    m_lastSegment = segment.last;
+    m_kissState = segment.state;
+    setSharedState(m_kissState);
+    return true;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Makes the motor move. Call repeatedly and often for smooth motion, or from a timer interrupt.
+No floating point math is done here.
+Returns the state of the segment being executed, or STATE_STOPPED once the last segment of a move
+has been executed and nothing else is queued.
+
+If the queue runs dry part way through a move, the planner has fallen behind. The motor waits where
+it is without stopping, and carries on from the current time once more segments arrive.
+---------------------------------------------------------------------------------------------------- */
+
+kissState_t kissStepperExecutor::move(void)
+{
+    uint32_t curTime = micros();
+
+    // see kissStepperPlanner::stop()
+    if (m_queue.isStopRequested()) stop();
+
+    if (m_kissState > STATE_STARTING)
+    {
+        if (curTime - m_lastStepTime >= m_stepIntervalWhole)
+        {
+            // the queue ran dry before the end of the move, see below
+            if (m_distMoved == m_distTotal)
+            {
+                if (!nextSegment()) return m_kissState;
+                // take the next step as soon as it is due, rather than catching up on the steps missed
+                if (curTime - m_lastStepTime > m_stepIntervalWhole) m_lastStepTime = curTime - m_stepIntervalWhole;
+                return m_kissState;
+            }
+
+            m_lastStepTime += m_stepIntervalWhole;
+
+            // correct lastStepTime (only non-zero for run segments)
+            if (m_stepIntervalCorrectionCounter < m_stepIntervalRemainder) m_lastStepTime++;
+            m_stepIntervalCorrectionCounter += INTERVAL_CORRECTION_INCREMENT;
+
+            // do the step pulse, see kissStepperNoAccel::move()
+            noInterrupts();
+            *m_stepOut |= m_stepBit;
+            delayMicroseconds(PULSE_WIDTH_US); // busy wait
+            *m_stepOut ^= m_stepBit;
+            interrupts();
+
+            if (m_trace) m_trace->record(curTime, m_kissState, m_stepIntervalWhole);
+
+            m_distMoved++;
+
+            // the motor only stops at the end of a move, if the queue runs dry before then the
+            // next call waits for the planner
+            if ((m_distMoved == m_distTotal) && !nextSegment() && m_lastSegment)
+            {
+                kissStepperNoAccel::stop();
+                setSharedState(STATE_STOPPED);
+            }
+        }
+    }
+    else if (!m_queue.isEmpty())
+    {
+        // wake the motor controller as soon as anything is queued, and hold the first segment until
+        // it is awake
+        if (!m_init) begin();
+        wake();
+        if (isAwake(curTime, 0))
+        {
+            // publish that the executor is busy before the queue can be seen empty, see getState()
+            setSharedState(STATE_STARTING);
+            nextSegment();
+            m_lastStepTime = curTime;
+        }
+    }
+    else if (m_idleActions)
+        idle(curTime);
+
+    return m_kissState;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Stops the motor and discards all queued segments. Only call from the executor's core.
+// To stop from the planner's side, call kissStepperPlanner::stop() instead.
+// ----------------------------------------------------------------------------------------------------
+
+void kissStepperExecutor::stop(void)
+{
+    m_queue.flush();
+    kissStepperNoAccel::stop();
+    setSharedState(STATE_STOPPED);
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Step trace
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+/* ----------------------------------------------------------------------------------------------------
+Prints the trace, oldest step first. Only call while the motor is stopped.
+
+The format is two header lines followed by one line per step held:
+    kissStepTrace v1
+    steps,total
+    state,interval,timeDelta
+
+total is the number of steps recorded since clearing. If it is more than the number of lines, the
+lines are the last steps of the move. The timeDelta of the first step after clearing is printed as -.
+
+The state and interval columns are fully determined by the move and its speed, acceleration and
+ramp settings, so traces of the same move from two builds can be compared line by line.
+The timeDelta column shows how late move() was called, and will vary from run to run.
+---------------------------------------------------------------------------------------------------- */
+
+void kissStepTrace::dump(Print &out)
+{
+    out.println(F("kissStepTrace v1"));
+    out.print(F("steps,"));
+    out.println(m_total);
+    for (uint16_t i = 0; i < m_count; i++)
+    {
+        kissTraceEntry_t entry = getEntry(i);
+        out.print((uint8_t)entry.state);
+        out.print(',');
+        out.print(entry.interval);
+        out.print(',');
+        if (entry.timeDelta == NO_TIME_DELTA)
+            out.println('-');
+        else
+            out.println(entry.timeDelta);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Resonance avoidance
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+kissResonance::kissResonance(void) :
+    m_bandCount(0),
+    m_boost(DEFAULT_BOOST),
+    m_frequency(0),
+    m_halfPeriod(0),
+    m_impulse1(1.0),
+    m_impulse2(0),
+    m_shaping(false),
+    m_accelLowInterval(0),
+    m_accelHighInterval(0),
+    m_decelLowInterval(0),
+    m_decelHighInterval(0)
+{}
+
+// ----------------------------------------------------------------------------------------------------
+// Adds a band of speeds (inclusive) that the motor should not run at
+// Returns FALSE if the band is invalid or there is no room left for it
+// Bands must start above 1 Hz, so there is always a speed below them to run at
+// ----------------------------------------------------------------------------------------------------
+
+bool kissResonance::addSpeedBand(uint16_t lowSpeed, uint16_t highSpeed)
+{
+    if ((lowSpeed <= 1) || (lowSpeed >= highSpeed) || (m_bandCount == KISS_MAX_SPEED_BANDS))
+        return false;
+    m_bandLowSpeed[m_bandCount] = lowSpeed;
+    m_bandHighSpeed[m_bandCount] = highSpeed;
+    m_bandLowInterval[m_bandCount] = (float)ONE_SECOND / highSpeed;
+    m_bandHighInterval[m_bandCount] = (float)ONE_SECOND / lowSpeed;
+    m_bandCount++;
+    return true;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Sets up a ZV (zero vibration) input shaper for ringing at the given frequency (Hz) and damping ratio
+(0 to just under 1). A frequency of 0 turns the shaper off.
+
+The shaper accelerates at impulse1 * accel for the first half period of each ramp, and impulse2 * accel
+for the last half period, where
+    K = exp(-damping * pi / sqrt(1 - damping^2))
+    impulse1 = 1 / (1 + K)
+    impulse2 = K / (1 + K)
+    half period = 1 / (2 * frequency * sqrt(1 - damping^2))
+---------------------------------------------------------------------------------------------------- */
+
+void kissResonance::setShaper(float frequency, float damping)
+{
+    if ((frequency <= 0) || (damping < 0) || (damping >= 1.0))
+    {
+        m_frequency = 0;
+        m_halfPeriod = 0;
+        m_impulse1 = 1.0;
+        m_impulse2 = 0;
+        return;
+    }
+    float dampedRoot = sqrt(1.0 - damping * damping);
+    float K = exp(-damping * PI / dampedRoot);
+    m_frequency = frequency;
+    m_halfPeriod = 1.0 / (2.0 * frequency * dampedRoot);
+    m_impulse1 = 1.0 / (1.0 + K);
+    m_impulse2 = K / (1.0 + K);
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Returns the highest speed at or below topSpeed that isn't in a band
+// This is never 0 for a topSpeed above 0, as bands start above 1 Hz
+// ----------------------------------------------------------------------------------------------------
+
+uint16_t kissResonance::limitTopSpeed(uint16_t topSpeed)
+{
+    // bands may overlap, so keep going until nothing changes
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint8_t i = 0; i < m_bandCount; i++)
+        {
+            if ((topSpeed >= m_bandLowSpeed[i]) && (topSpeed <= m_bandHighSpeed[i]))
+            {
+                topSpeed = m_bandLowSpeed[i] - 1;
+                changed = true;
+            }
+        }
+    }
+    return topSpeed;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// Returns the steps saved by boosting through bands on a ramp between 0 and speed
+// A band the ramp only reaches part way into saves only that part
+// ----------------------------------------------------------------------------------------------------
+
+float kissResonance::savedDist(float speed, uint16_t accel)
+{
+    float dist = 0;
+    for (uint8_t i = 0; i < m_bandCount; i++)
+    {
+        if (m_bandLowSpeed[i] < speed)
+        {
+            float highSpeed = (m_bandHighSpeed[i] < speed) ? m_bandHighSpeed[i] : speed;
+            float bandDist = (highSpeed * highSpeed - (float)m_bandLowSpeed[i] * m_bandLowSpeed[i]) / (2.0 * accel);
+            dist += bandDist * (1.0 - 1.0 / m_boost);
+        }
+    }
+    return dist;
+}
+
+/* ----------------------------------------------------------------------------------------------------
+Fits the speed profile calculated by prepareMove() around the bands and the shaper.
+distRun is cumulative (the end of the run), as in kissStepper.
+
+- a top speed inside a band is lowered to just below the band, with or without acceleration
+- the shaped profile is the average of the original profile and a copy delayed by half a period, so
+  it covers the same distance, but ramps take an extra impulse1 * topSpeed * halfPeriod steps to
+  accelerate and impulse2 * topSpeed * halfPeriod steps to decelerate, all taken from the run
+- if the run is too short for that, the top speed is lowered until it fits:
+  topSpeed^2 / accel + topSpeed * halfPeriod = distTotal
+- the shaper is skipped for moves whose ramps are shorter than half a period
+- boosted acceleration through bands below the top speed shortens the ramps, and those steps are
+  given back to the run
+
+The step based ramp is only approximately linear, so this is approximate too. Any error ends up as
+a few steps at top speed or at the minimum speed, as it does without resonance avoidance.
+---------------------------------------------------------------------------------------------------- */
+
+void kissResonance::adjustProfile(uint32_t distTotal, uint16_t accel, uint16_t &topSpeed, uint32_t &distAccel, uint32_t &distRun)
+{
+    m_shaping = false;
+    if (topSpeed == 0) return;
+
+    uint16_t newTopSpeed = limitTopSpeed(topSpeed);
+
+    // without acceleration the motor runs at top speed from the first step, so only the bands apply
+    if (accel == 0)
+    {
+        topSpeed = newTopSpeed;
+        return;
+    }
+
+    if (m_halfPeriod > 0)
+    {
+        uint16_t shapedTopSpeed = newTopSpeed;
+        float fitSpeed = accel * (sqrt(m_halfPeriod * m_halfPeriod + (4.0 * distTotal) / accel) - m_halfPeriod) / 2.0;
+        if (shapedTopSpeed > fitSpeed) shapedTopSpeed = limitTopSpeed(fitSpeed);
+        if (shapedTopSpeed >= accel * m_halfPeriod)
+        {
+            newTopSpeed = shapedTopSpeed;
+            m_shaping = true;
+        }
+    }
+
+    topSpeed = newTopSpeed;
+
+    // the step interval at top speed is a whole number of microseconds, so the motor really runs a
+    // little faster than topSpeed, and needs a little further to accelerate and decelerate
+    float runSpeed = (float)ONE_SECOND / (ONE_SECOND / topSpeed);
+    float rampDist = (runSpeed * runSpeed) / (2.0 * accel);
+
+    // steps saved by boosting through bands
+    float boostDist = savedDist(topSpeed, accel);
+
+    // extra steps needed by the shaper
+    float shapeAccelDist = 0;
+    float shapeDecelDist = 0;
+    if (m_shaping)
+    {
+        shapeAccelDist = m_impulse1 * runSpeed * m_halfPeriod;
+        shapeDecelDist = m_impulse2 * runSpeed * m_halfPeriod;
+
+        // step intervals where the shaper changes the acceleration (see setShaper())
+        m_accelLowInterval = ONE_SECOND / (m_impulse1 * accel * m_halfPeriod);
+        m_accelHighInterval = ONE_SECOND / (runSpeed - m_impulse2 * accel * m_halfPeriod);
+        m_decelHighInterval = ONE_SECOND / (runSpeed - m_impulse1 * accel * m_halfPeriod);
+        m_decelLowInterval = ONE_SECOND / (m_impulse2 * accel * m_halfPeriod);
+    }
+
+    float distDecel = rampDist + shapeDecelDist - boostDist;
+    if (distDecel < 0) distDecel = 0;
+    if (distDecel > distTotal) distDecel = distTotal;
+
+    // if rounding leaves too little room, cut the acceleration short rather than the deceleration
+    float newDistAccel = rampDist + shapeAccelDist - boostDist;
+    if (newDistAccel > distTotal - distDecel) newDistAccel = distTotal - distDecel;
+    if (newDistAccel < 0) newDistAccel = 0;
+
+    distAccel = newDistAccel;
+    distRun = distTotal - (uint32_t)distDecel;
+}
@@ -19,6 +19,7 @@ Acceleration approximation math is based on Aryeh Eiderman's "Real Time Stepper
 #define kissStepper_H
 
 #include <Arduino.h>
+#include <Print.h>
 
 // determine port register size
 #if defined(__AVR__) || defined(__avr__)
@@ -33,6 +34,87 @@ Acceleration approximation math is based on Aryeh Eiderman's "Real Time Stepper
 	typedef uint32_t regint;
 #endif
 
+// compiler/hardware memory barrier for the lock-free segment queue
+// single-core AVR only needs to stop the compiler from reordering memory accesses
+#if defined(__AVR__) || defined(__avr__)
+	#define KISS_MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+	#define KISS_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// build options
+// KISS_WIDE_POSITION, KISS_SEGMENT_QUEUE_SIZE, KISS_TRACE_SIZE and KISS_MAX_SPEED_BANDS change the
+// size of the classes, so the sketch and the library must agree on them. Set them in your platform's
+// build flags (eg -DKISS_WIDE_POSITION), never with #define before including kissStepper.h, which
+// only reaches the sketch. A mismatch is caught when linking, see the end of this section.
+
+// position type
+// define KISS_WIDE_POSITION for 64-bit positions and limits
+// distances moved are still counted in 32 bits, and folded into the position when the motor stops
+// or the executor moves on to a new segment, so stepping costs the same in either mode
+#ifdef KISS_WIDE_POSITION
+	typedef int64_t kissPos_t;
+	#define KISS_POS_MAX 9223372036854775807LL
+	#define KISS_POS_MIN (-9223372036854775807LL - 1)
+#else
+	typedef int32_t kissPos_t;
+	#define KISS_POS_MAX 2147483647L
+	#define KISS_POS_MIN (-2147483647L - 1)
+#endif
+
+// a single move is limited to the range of the 32-bit distance counters
+inline kissPos_t kissLimitMove(kissPos_t target, kissPos_t pos)
+{
+#ifdef KISS_WIDE_POSITION
+    static const uint32_t MAX_MOVE_DIST = 4294967295UL;
+    if ((target > pos) && ((uint64_t)target - (uint64_t)pos > MAX_MOVE_DIST))
+        return pos + MAX_MOVE_DIST;
+    if ((target < pos) && ((uint64_t)pos - (uint64_t)target > MAX_MOVE_DIST))
+        return pos - MAX_MOVE_DIST;
+#else
+    (void)pos;
+#endif
+    return target;
+}
+
+// number of segments held by kissSegmentQueue
+// must be a plain number, a power of 2, no larger than 128
+#ifndef KISS_SEGMENT_QUEUE_SIZE
+	#define KISS_SEGMENT_QUEUE_SIZE 16
+#endif
+
+// number of steps held by kissStepTrace
+// must be a plain number, a power of 2, no larger than 32768
+#ifndef KISS_TRACE_SIZE
+	#define KISS_TRACE_SIZE 32
+#endif
+
+// number of forbidden speed bands held by kissResonance
+// must be a plain number
+#ifndef KISS_MAX_SPEED_BANDS
+	#define KISS_MAX_SPEED_BANDS 4
+#endif
+
+// Link-time check of the build options
+// Every file that includes kissStepper.h reads a symbol whose name spells out its build options, and
+// only kissStepper.cpp defines it. If the sketch and the library were built with different options,
+// linking fails with an undefined reference to kissConfig_<options>.
+// The read is done once at startup, from a constructor, so it can't be optimized away.
+#ifdef KISS_WIDE_POSITION
+	#define KISS_CONFIG_POS pos64
+#else
+	#define KISS_CONFIG_POS pos32
+#endif
+#define KISS_CONFIG_JOIN(pos, queue, trace, bands) kissConfig_##pos##_queue##queue##_trace##trace##_bands##bands
+#define KISS_CONFIG_NAME(pos, queue, trace, bands) KISS_CONFIG_JOIN(pos, queue, trace, bands)
+#define KISS_CONFIG_SYMBOL KISS_CONFIG_NAME(KISS_CONFIG_POS, KISS_SEGMENT_QUEUE_SIZE, KISS_TRACE_SIZE, KISS_MAX_SPEED_BANDS)
+
+extern const uint8_t KISS_CONFIG_SYMBOL;
+__attribute__((constructor)) static void kissCheckConfig(void)
+{
+    (void)*(volatile const uint8_t *)&KISS_CONFIG_SYMBOL;
+}
+
 
 // the order of enums allows some simple tests:
 // if > STATE_STARTING, motor is in motion
@@ -46,6 +128,303 @@ enum kissState_t: uint8_t
     STATE_DECEL = 4
 };
 
+/*
+   ----------------------------------------------------------------------------------------------------
+
+       To strike a balance between accuracy and performance, this library uses a set of approximations
+       for calculating stepInterval when accelerating/decelerating. Although this does use floating point
+       math, it is a drastic improvement over exact calculations and better than anything else I've tried.
+
+       There is probably room for further improvement (fixed point or integer math?) but this is good enough.
+
+       exact:
+           stepInterval = ONE_SECOND / newSpeed
+           curSpeed = ONE_SECOND / stepInterval
+           newSpeed = sqrt(curSpeed^2 + 2a)
+           stepInterval = ONE_SECOND / sqrt(curSpeed^2 + 2a)
+
+       approximations:
+           constMult = accel / (ONE_SECOND * ONE_SECOND)
+           q = constMult*stepInterval*stepInterval
+           set q to negative if accelerating
+
+           good precision, fast: stepInterval *= 1.0 + q (RAMP_FAST)
+           better precision, slower: stepInterval *= 1.0 + q + q*q (RAMP_BETTER)
+           best precision, slowest: stepInterval *= 1.0 + q + 1.5*q*q (RAMP_BEST)
+
+       The approximation is selectable per instance with setRamp(). The RampBenchmark example measures
+       the cost and accuracy of each on your hardware.
+
+       These are shared by kissStepper and kissStepperPlanner, through kissRampProfile, which clamps the result.
+
+   ----------------------------------------------------------------------------------------------------
+   */
+
+enum kissRamp_t: uint8_t
+{
+    RAMP_FAST = 0,
+    RAMP_BETTER = 1,
+    RAMP_BEST = 2
+};
+
+inline float kissRampStep(float stepInterval, float q, kissRamp_t ramp)
+{
+    switch (ramp)
+    {
+    case RAMP_BETTER:
+        return stepInterval * (1.0 + q + q*q);
+    case RAMP_BEST:
+        return stepInterval * (1.0 + q + 1.5*q*q);
+    default:
+        return stepInterval * (1.0 + q);
+    }
+}
+
+inline float kissAccelStep(float stepInterval, float constMult, kissRamp_t ramp = RAMP_FAST)
+{
+    return kissRampStep(stepInterval, -constMult*stepInterval*stepInterval, ramp);
+}
+
+inline float kissDecelStep(float stepInterval, float constMult, kissRamp_t ramp = RAMP_FAST)
+{
+    return kissRampStep(stepInterval, constMult*stepInterval*stepInterval, ramp);
+}
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Step trace
+// Records the most recent steps taken by move(), for comparing motion between builds
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+struct kissTraceEntry_t
+{
+    uint32_t interval; // interval that move() was waiting for, in microseconds
+    uint32_t timeDelta; // actual time since the previous step, in microseconds, or kissStepTrace::NO_TIME_DELTA
+    kissState_t state; // state when the step was taken
+};
+
+class kissStepTrace
+{
+public:
+    // timeDelta of the first step recorded after clearing, which has no previous step
+    static const uint32_t NO_TIME_DELTA = 0xFFFFFFFF;
+
+    kissStepTrace(void) : m_next(0), m_count(0), m_total(0), m_lastTime(0) {};
+
+    // called by move() after each step pulse
+    void record(uint32_t curTime, kissState_t state, uint32_t interval)
+    {
+        kissTraceEntry_t &entry = m_entries[m_next & INDEX_MASK];
+        entry.interval = interval;
+        entry.timeDelta = (m_total == 0) ? NO_TIME_DELTA : curTime - m_lastTime;
+        entry.state = state;
+        m_lastTime = curTime;
+        m_next++;
+        m_total++;
+        if (m_count < KISS_TRACE_SIZE) m_count++;
+    }
+
+    void clear(void)
+    {
+        m_next = 0;
+        m_count = 0;
+        m_total = 0;
+        m_lastTime = 0;
+    }
+    uint16_t getCount(void)
+    {
+        return m_count;
+    }
+    // number of steps recorded since clearing, including those no longer held
+    uint32_t getTotal(void)
+    {
+        return m_total;
+    }
+    // i = 0 is the oldest step held
+    kissTraceEntry_t getEntry(uint16_t i)
+    {
+        return m_entries[(uint16_t)(m_next - m_count + i) & INDEX_MASK];
+    }
+    void dump(Print &out);
+
+private:
+    static const uint16_t INDEX_MASK = KISS_TRACE_SIZE - 1;
+
+    kissTraceEntry_t m_entries[KISS_TRACE_SIZE];
+    uint16_t m_next;
+    uint16_t m_count;
+    uint32_t m_total;
+    uint32_t m_lastTime;
+};
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Resonance avoidance
+// Forbidden speed bands are passed through at a boosted acceleration, and never used as a top speed.
+// The optional ZV input shaper splits each change in acceleration into two, half a ringing period
+// apart, which cancels most of the ringing at that frequency.
+// Both work by scaling the acceleration of each step, so they only affect kissStepper and kissStepperPlanner.
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+class kissResonance
+{
+public:
+    kissResonance(void);
+
+    bool addSpeedBand(uint16_t lowSpeed, uint16_t highSpeed);
+    void clearSpeedBands(void)
+    {
+        m_bandCount = 0;
+    }
+    uint8_t getSpeedBandCount(void)
+    {
+        return m_bandCount;
+    }
+    void setBandBoost(uint8_t boost)
+    {
+        if (boost > 0) m_boost = boost;
+    }
+    uint8_t getBandBoost(void)
+    {
+        return m_boost;
+    }
+    void setShaper(float frequency, float damping = 0.0);
+    float getShaperFrequency(void)
+    {
+        return m_frequency;
+    }
+
+    // called by prepareMove() to fit the speed profile around the bands and the shaper
+    void adjustProfile(uint32_t distTotal, uint16_t accel, uint16_t &topSpeed, uint32_t &distAccel, uint32_t &distRun);
+    // steps saved by boosting through bands on a ramp between 0 and speed
+    float savedDist(float speed, uint16_t accel);
+    // called by decelerate(), the shaper can't follow an early deceleration
+    void cancelShaping(void)
+    {
+        m_shaping = false;
+    }
+
+    // acceleration multipliers for the step about to be taken
+    float accelMult(float stepInterval)
+    {
+        float mult = 1.0;
+        if (m_shaping)
+        {
+            if (stepInterval > m_accelLowInterval)
+                mult = m_impulse1;
+            else if (stepInterval < m_accelHighInterval)
+                mult = m_impulse2;
+        }
+        if (inSpeedBand(stepInterval)) mult *= m_boost;
+        return mult;
+    }
+    float decelMult(float stepInterval)
+    {
+        float mult = 1.0;
+        if (m_shaping)
+        {
+            if (stepInterval < m_decelHighInterval)
+                mult = m_impulse1;
+            else if (stepInterval > m_decelLowInterval)
+                mult = m_impulse2;
+        }
+        if (inSpeedBand(stepInterval)) mult *= m_boost;
+        return mult;
+    }
+
+private:
+    static const uint32_t ONE_SECOND = 1000000UL;
+    static const uint8_t DEFAULT_BOOST = 2;
+
+    bool inSpeedBand(float stepInterval)
+    {
+        for (uint8_t i = 0; i < m_bandCount; i++)
+        {
+            if ((stepInterval >= m_bandLowInterval[i]) && (stepInterval <= m_bandHighInterval[i])) return true;
+        }
+        return false;
+    }
+    uint16_t limitTopSpeed(uint16_t topSpeed);
+
+    // bands, as speeds for planning and as step intervals for the per-step checks
+    uint16_t m_bandLowSpeed[KISS_MAX_SPEED_BANDS];
+    uint16_t m_bandHighSpeed[KISS_MAX_SPEED_BANDS];
+    float m_bandLowInterval[KISS_MAX_SPEED_BANDS];
+    float m_bandHighInterval[KISS_MAX_SPEED_BANDS];
+    uint8_t m_bandCount;
+    uint8_t m_boost;
+
+    // ZV shaper, impulse1 + impulse2 = 1
+    float m_frequency;
+    float m_halfPeriod; // seconds
+    float m_impulse1, m_impulse2;
+
+    // step intervals where the shaper changes the acceleration, for the current move
+    bool m_shaping;
+    float m_accelLowInterval, m_accelHighInterval;
+    float m_decelLowInterval, m_decelHighInterval;
+};
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Speed profile
+// The acceleration settings, speed profile and ramp steps shared by kissStepper and kissStepperPlanner
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+class kissRampProfile
+{
+protected:
+    kissRampProfile(void);
+
+    // distance to accelerate from 0 to maxSpeed, or to decelerate back
+    uint32_t maxAccelDist(uint16_t maxSpeed)
+    {
+        if (m_accel > 0)
+            return ((uint32_t)maxSpeed * maxSpeed) / (2UL * m_accel);
+        else
+            return 0;
+    }
+    float calcProfile(uint32_t distTotal, uint16_t maxSpeed, uint16_t &stepIntervalRemainder);
+
+    float accelStep(float stepInterval)
+    {
+        float constMult = m_constMult;
+        if (m_resonance) constMult *= m_resonance->accelMult(stepInterval);
+        float newStepInterval = kissAccelStep(stepInterval, constMult, m_ramp);
+        if (newStepInterval < m_topSpeedStepInterval) newStepInterval = m_topSpeedStepInterval;
+        return newStepInterval;
+    }
+    float decelStep(float stepInterval)
+    {
+        float constMult = m_constMult;
+        if (m_resonance) constMult *= m_resonance->decelMult(stepInterval);
+        float newStepInterval = kissDecelStep(stepInterval, constMult, m_ramp);
+        if (newStepInterval > m_minSpeedStepInterval) newStepInterval = m_minSpeedStepInterval;
+        return newStepInterval;
+    }
+
+    static const uint16_t DEFAULT_ACCEL = 1600;
+
+    uint16_t m_accel;
+    kissRamp_t m_ramp;
+    kissResonance *m_resonance;
+
+    // cumulative step counts at which acceleration and the run end
+    uint32_t m_distAccel, m_distRun;
+    uint32_t m_topSpeedStepInterval;
+    uint32_t m_minSpeedStepInterval;
+    float m_constMult;
+};
+
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
@@ -61,7 +440,7 @@ public:
     kissStepperNoAccel(uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir = false);
     ~kissStepperNoAccel(void) {};
 
-    bool prepareMove(int32_t target);
+    bool prepareMove(kissPos_t target);
     kissState_t move(void);
     void stop(void);
 
@@ -76,12 +455,30 @@ public:
     {
         return m_kissState;
     }
-    int32_t getPos(void)
+    kissPos_t getPos(void)
     {
-        if (m_forwards)
-            return m_pos + m_distMoved;
+        // the position can't be read atomically, and move() may be running in an interrupt or on
+        // another core, so retry until nothing changed while reading
+        // must not be called from an interrupt that can interrupt move() on the same core, as move()
+        // can't finish a fold while it's interrupted, so this would wait forever
+        kissPos_t pos;
+        uint32_t distMoved;
+        bool forwards;
+        uint8_t posGeneration;
+        do
+        {
+            posGeneration = m_posGeneration;
+            KISS_MEMORY_BARRIER();
+            pos = m_pos;
+            distMoved = m_distMoved;
+            forwards = m_forwards;
+            KISS_MEMORY_BARRIER();
+        }
+        while ((posGeneration & 1) || (posGeneration != m_posGeneration) || (distMoved != m_distMoved));
+        if (forwards)
+            return pos + distMoved;
         else
-            return m_pos - m_distMoved;
+            return pos - distMoved;
     }
     bool isEnabled(void)
     {
@@ -94,13 +491,29 @@ public:
     void begin(void);
     void enable(void);
     void disable(void);
+    void setAutoDisable(uint16_t holdTime);
+    void setReducedCurrentPin(uint8_t pin, uint16_t reduceTime = 0);
+    // microseconds
+    void setWakeTime(uint16_t wakeTime)
+    {
+        m_wakeDelay = wakeTime;
+    }
+    bool isCurrentReduced(void)
+    {
+        return m_currentReduced;
+    }
+    // pass NULL to stop tracing
+    void setTrace(kissStepTrace *trace)
+    {
+        m_trace = trace;
+    }
 
-    void setPos(int32_t pos)
+    void setPos(kissPos_t pos)
     {
         if (m_kissState == STATE_STOPPED)
             m_pos = constrain(pos, m_reverseLimit, m_forwardLimit);
     }
-    int32_t getTarget(void)
+    kissPos_t getTarget(void)
     {
         if (m_kissState == STATE_STOPPED)
             return m_pos;
@@ -113,19 +526,19 @@ public:
     {
         return m_distTotal - m_distMoved;
     }
-    void setForwardLimit(int32_t forwardLimit)
+    void setForwardLimit(kissPos_t forwardLimit)
     {
         m_forwardLimit = forwardLimit;
     }
-    void setReverseLimit(int32_t reverseLimit)
+    void setReverseLimit(kissPos_t reverseLimit)
     {
         m_reverseLimit = reverseLimit;
     }
-    int32_t getForwardLimit(void)
+    kissPos_t getForwardLimit(void)
     {
         return m_forwardLimit;
     }
-    int32_t getReverseLimit(void)
+    kissPos_t getReverseLimit(void)
     {
         return m_reverseLimit;
     }
@@ -146,21 +559,60 @@ protected:
     }
     void updatePos(void)
     {
+        // odd generation means a fold is in progress, see getPos()
+        m_posGeneration++;
+        KISS_MEMORY_BARRIER();
         if (m_forwards)
             m_pos += m_distMoved;
         else
             m_pos -= m_distMoved;
         m_distMoved = 0;
+        KISS_MEMORY_BARRIER();
+        m_posGeneration++;
+    }
+    // called on stopping, starts the timers for the idle actions
+    void startIdle(void)
+    {
+        if (m_enabled && m_idleConfig)
+        {
+            m_idleActions = m_idleConfig;
+            m_stopTime = micros();
+        }
+    }
+    // called before moving, cancels idle actions and brings the driver back to full current
+    void wake(void)
+    {
+        m_idleActions = 0;
+        if (!m_enabled || m_currentReduced)
+            enable();
+        // forget a wake up that is long over, so isAwake() never compares a stale time
+        else if (m_waking && (micros() - m_wakeTime >= m_wakeDelay))
+            m_waking = false;
+    }
+    void idle(uint32_t curTime);
+    // TRUE once a step taken firstInterval from now would come at least wakeDelay after enabling
+    bool isAwake(uint32_t curTime, uint32_t firstInterval)
+    {
+        if (m_waking)
+        {
+            // signed, because move() may read curTime just before waking the motor controller
+            int32_t wakeTime = curTime - m_wakeTime;
+            if (wakeTime + (int32_t)firstInterval < (int32_t)m_wakeDelay) return false;
+            m_waking = false;
+        }
+        return true;
     }
+    static const uint8_t IDLE_REDUCE = 1;
+    static const uint8_t IDLE_DISABLE = 2;
     static const uint32_t ONE_SECOND = 1000000UL;
     static const uint8_t PULSE_WIDTH_US = 2; // desired width of step pulse (high) in us
-    static const int32_t DEFAULT_FORWARD_LIMIT = 2147483647L;
-    static const int32_t DEFAULT_REVERSE_LIMIT = -2147483648L;
+    static const kissPos_t DEFAULT_FORWARD_LIMIT = KISS_POS_MAX;
+    static const kissPos_t DEFAULT_REVERSE_LIMIT = KISS_POS_MIN;
     static const uint16_t DEFAULT_SPEED = 1600;
     static const uint16_t INTERVAL_CORRECTION_INCREMENT = 255;
 
-    int32_t m_forwardLimit;
-    int32_t m_reverseLimit;
+    kissPos_t m_forwardLimit;
+    kissPos_t m_reverseLimit;
     uint16_t m_maxSpeed;
 
     const uint8_t PIN_DIR;
@@ -170,7 +622,8 @@ protected:
     kissState_t m_kissState;
     uint32_t m_distTotal, m_distMoved;
     bool m_forwards;
-    int32_t m_pos;
+    kissPos_t m_pos;
+    volatile uint8_t m_posGeneration;
 
 	const regint m_stepBit;
     regint volatile * const m_stepOut;
@@ -182,6 +635,23 @@ protected:
     uint32_t m_lastStepTime;
     bool m_invertDir;
     bool m_init;
+
+    // idle current reduction
+    // delays are stored in microseconds so move() can compare them against micros() directly
+    uint8_t m_reducePin;
+    bool m_currentReduced;
+    uint8_t m_idleConfig;
+    uint8_t m_idleActions;
+    uint32_t m_stopTime;
+    uint32_t m_reduceDelay;
+    uint32_t m_disableDelay;
+
+    // time for the motor controller to wake up before the first step, in microseconds
+    bool m_waking;
+    uint16_t m_wakeDelay;
+    uint32_t m_wakeTime;
+
+    kissStepTrace *m_trace;
 };
 
 // ----------------------------------------------------------------------------------------------------
@@ -192,13 +662,13 @@ protected:
 // ----------------------------------------------------------------------------------------------------
 // ----------------------------------------------------------------------------------------------------
 
-class kissStepper: public kissStepperNoAccel
+class kissStepper: public kissStepperNoAccel, protected kissRampProfile
 {
 public:
     kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_t PIN_ENABLE = 255, bool invertDir = false);
     kissStepper(uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir = false);
     ~kissStepper(void) {};
-    bool prepareMove(int32_t target);
+    bool prepareMove(kissPos_t target);
     kissState_t move(void);
     void stop(void);
     
@@ -219,10 +689,7 @@ public:
     void decelerate(void);
     uint32_t calcMaxAccelDist(void)
     {
-        if (m_accel > 0)
-            return ((uint32_t)m_maxSpeed * m_maxSpeed) / (2UL * m_accel);
-        else
-            return 0;
+        return maxAccelDist(m_maxSpeed);
     }
     uint32_t getAccelDist(void)
     {
@@ -244,69 +711,270 @@ public:
     {
         return m_accel;
     }
+    void setRamp(kissRamp_t ramp)
+    {
+        if (m_kissState == STATE_STOPPED) m_ramp = ramp;
+    }
+    kissRamp_t getRamp(void)
+    {
+        return m_ramp;
+    }
+    // pass NULL to remove
+    void setResonance(kissResonance *resonance)
+    {
+        if (m_kissState == STATE_STOPPED) m_resonance = resonance;
+    }
     uint16_t getTopSpeed(void);
 
 protected:
 
-    static const uint16_t DEFAULT_ACCEL = 1600;
-    uint32_t m_distAccel, m_distRun;
-    uint32_t m_topSpeedStepInterval;
-    uint32_t m_minSpeedStepInterval;
     float m_stepInterval;
-    float m_constMult;
-    uint16_t m_accel;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// Split planner/executor
+// The planner does the floating point ramp math and fills a queue with segments of step intervals.
+// The executor pulls segments from the queue and pulses the pins using only integer math.
+// The queue is single-producer/single-consumer: one planner and one executor per queue, which may
+// run on different cores or with the executor in a timer interrupt.
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+
+// a run of steps sharing the same interval and direction
+struct kissSegment_t
+{
+    uint32_t interval; // whole microseconds between step pulses
+    uint16_t remainder; // interval correction, see kissStepperNoAccel::move()
+    uint16_t steps; // number of step pulses in this segment
+    kissState_t state; // part of the speed profile this segment belongs to
+    bool forwards;
+    bool last; // last segment of a move
+};
+
+class kissSegmentQueue
+{
+public:
+    kissSegmentQueue(void) : m_head(0), m_tail(0), m_stopRequested(false) {};
+
+    bool isEmpty(void)
+    {
+        return m_head == m_tail;
+    }
+    bool isFull(void)
+    {
+        return (uint8_t)(m_head - m_tail) == KISS_SEGMENT_QUEUE_SIZE;
+    }
+
+    // only call from the producer (planner)
+    bool push(const kissSegment_t &segment)
+    {
+        uint8_t head = m_head;
+        if ((uint8_t)(head - m_tail) == KISS_SEGMENT_QUEUE_SIZE) return false;
+        m_segments[head & INDEX_MASK] = segment;
+        // the segment must be visible before the consumer sees the new head
+        KISS_MEMORY_BARRIER();
+        m_head = head + 1;
+        return true;
+    }
+
+    // only call from the consumer (executor)
+    bool pop(kissSegment_t &segment)
+    {
+        uint8_t tail = m_tail;
+        if (m_head == tail) return false;
+        KISS_MEMORY_BARRIER();
+        segment = m_segments[tail & INDEX_MASK];
+        // finish reading the segment before the producer is allowed to overwrite it
+        KISS_MEMORY_BARRIER();
+        m_tail = tail + 1;
+        return true;
+    }
+
+    // only call from the consumer (executor), also clears a stop request
+    void flush(void)
+    {
+        m_tail = m_head;
+        KISS_MEMORY_BARRIER();
+        m_stopRequested = false;
+    }
+
+    // only call from the producer (planner), the consumer stops and flushes the queue when it sees it
+    void requestStop(void)
+    {
+        KISS_MEMORY_BARRIER();
+        m_stopRequested = true;
+    }
+    bool isStopRequested(void)
+    {
+        return m_stopRequested;
+    }
 
 private:
+    static const uint8_t INDEX_MASK = KISS_SEGMENT_QUEUE_SIZE - 1;
+
+    kissSegment_t m_segments[KISS_SEGMENT_QUEUE_SIZE];
+
+    // free-running indexes, each written by only one side
+    volatile uint8_t m_head;
+    volatile uint8_t m_tail;
+    // set by the producer, cleared by the consumer
+    volatile bool m_stopRequested;
+};
+
+class kissStepperPlanner: protected kissRampProfile
+{
+public:
+    kissStepperPlanner(kissSegmentQueue &queue);
+    ~kissStepperPlanner(void) {};
 
-    /*
-       ----------------------------------------------------------------------------------------------------
+    bool prepareMove(kissPos_t target);
+    kissState_t plan(void);
+    void stop(void);
 
-           To strike a balance between accuracy and performance, this library uses a set of approximations
-           for calculating stepInterval when accelerating/decelerating. Although this does use floating point
-           math, it is a drastic improvement over exact calculations and better than anything else I've tried.
+    kissState_t getState(void)
+    {
+        return m_kissState;
+    }
+    kissPos_t getPos(void)
+    {
+        if (m_forwards)
+            return m_pos + m_distPlanned;
+        else
+            return m_pos - m_distPlanned;
+    }
+    void setPos(kissPos_t pos)
+    {
+        if (m_kissState == STATE_STOPPED)
+            m_pos = constrain(pos, m_reverseLimit, m_forwardLimit);
+    }
+    void setForwardLimit(kissPos_t forwardLimit)
+    {
+        m_forwardLimit = forwardLimit;
+    }
+    void setReverseLimit(kissPos_t reverseLimit)
+    {
+        m_reverseLimit = reverseLimit;
+    }
+    kissPos_t getForwardLimit(void)
+    {
+        return m_forwardLimit;
+    }
+    kissPos_t getReverseLimit(void)
+    {
+        return m_reverseLimit;
+    }
+    void setMaxSpeed(uint16_t maxSpeed)
+    {
+        if (m_kissState == STATE_STOPPED) m_maxSpeed = maxSpeed;
+    }
+    uint16_t getMaxSpeed(void)
+    {
+        return m_maxSpeed;
+    }
+    void setAccel(uint16_t accel)
+    {
+        if (m_kissState == STATE_STOPPED) m_accel = accel;
+    }
+    uint16_t getAccel(void)
+    {
+        return m_accel;
+    }
+    void setRamp(kissRamp_t ramp)
+    {
+        if (m_kissState == STATE_STOPPED) m_ramp = ramp;
+    }
+    kissRamp_t getRamp(void)
+    {
+        return m_ramp;
+    }
+    // pass NULL to remove
+    void setResonance(kissResonance *resonance)
+    {
+        if (m_kissState == STATE_STOPPED) m_resonance = resonance;
+    }
+    uint32_t calcMaxAccelDist(void)
+    {
+        return maxAccelDist(m_maxSpeed);
+    }
 
-           There is probably room for further improvement (fixed point or integer math?) but this is good enough.
+protected:
+    static const uint32_t ONE_SECOND = 1000000UL;
+    static const kissPos_t DEFAULT_FORWARD_LIMIT = KISS_POS_MAX;
+    static const kissPos_t DEFAULT_REVERSE_LIMIT = KISS_POS_MIN;
+    static const uint16_t DEFAULT_SPEED = 1600;
+    static const uint16_t MAX_SEGMENT_STEPS = 65535;
 
-           exact:
-               stepInterval = ONE_SECOND / newSpeed
-               curSpeed = ONE_SECOND / stepInterval
-               newSpeed = sqrt(curSpeed^2 + 2a)
-               stepInterval = ONE_SECOND / sqrt(curSpeed^2 + 2a)
+    kissSegmentQueue &m_queue;
 
-           approximations:
-               constMult = accel / (ONE_SECOND * ONE_SECOND)
-               q = constMult*stepInterval*stepInterval
-               set q to negative if accelerating
+    kissPos_t m_forwardLimit;
+    kissPos_t m_reverseLimit;
+    uint16_t m_maxSpeed;
 
-               good precision, fast: stepInterval *= 1.0 + q
-               better precision, slower: stepInterval *= 1.0 + q + q*q
-               best precision, slowest: stepInterval *= 1.0 + q + 1.5*q*q
+    kissState_t m_kissState;
+    bool m_forwards;
+    kissPos_t m_pos;
+    uint32_t m_distTotal, m_distPlanned;
 
-       ----------------------------------------------------------------------------------------------------
-       */
+    uint16_t m_stepIntervalRemainder;
+    float m_stepInterval;
+
+private:
+    void finishPlan(void);
+};
+
+class kissStepperExecutor: protected kissStepperNoAccel
+{
+public:
+    kissStepperExecutor(kissSegmentQueue &queue, uint8_t PIN_DIR, uint8_t PIN_STEP, uint8_t PIN_ENABLE = 255, bool invertDir = false);
+    kissStepperExecutor(kissSegmentQueue &queue, uint8_t PIN_DIR, uint8_t PIN_STEP, bool invertDir = false);
+    ~kissStepperExecutor(void) {};
+
+    kissState_t move(void);
+    void stop(void);
+    void disable(void)
+    {
+        stop();
+        kissStepperNoAccel::disable();
+    }
 
-    float accelStep(float stepInterval, float constMult)
+    using kissStepperNoAccel::begin;
+    using kissStepperNoAccel::enable;
+    using kissStepperNoAccel::setAutoDisable;
+    using kissStepperNoAccel::setReducedCurrentPin;
+    using kissStepperNoAccel::setWakeTime;
+    using kissStepperNoAccel::isCurrentReduced;
+    using kissStepperNoAccel::setTrace;
+    using kissStepperNoAccel::isEnabled;
+    using kissStepperNoAccel::isMovingForwards;
+    using kissStepperNoAccel::getPos;
+    using kissStepperNoAccel::setPos;
+
+    // safe to call from the planner's core
+    // STATE_STOPPED means the queue has run dry, the motor has stopped, and any stop request is done
+    kissState_t getState(void)
     {
-        float newStepInterval;
-        float q = -constMult*stepInterval*stepInterval;
-        newStepInterval = stepInterval * (1.0 + q);
-        // newStepInterval = stepInterval * (1.0 + q + q*q); // better accuracy
-        // newStepInterval = stepInterval * (1.0 + q + 1.5*q*q); // best accuracy
-        if (newStepInterval < m_topSpeedStepInterval) newStepInterval = m_topSpeedStepInterval;
-        return newStepInterval;
+        // check the queue first, the executor publishes its state before taking the last segment
+        if (m_queue.isStopRequested() || !m_queue.isEmpty()) return STATE_STARTING;
+        KISS_MEMORY_BARRIER();
+        return m_sharedState;
     }
 
-    float decelStep(float stepInterval, float constMult)
+protected:
+    bool nextSegment(void);
+    void setSharedState(kissState_t state)
     {
-        float newStepInterval;
-        float q = constMult*stepInterval*stepInterval;
-        newStepInterval = stepInterval * (1.0 + q);
-        // newStepInterval = stepInterval * (1.0 + q + q*q); // better accuracy
-        // newStepInterval = stepInterval * (1.0 + q + 1.5*q*q); // best accuracy
-        if (newStepInterval > m_minSpeedStepInterval) newStepInterval = m_minSpeedStepInterval;
-        return newStepInterval;
+        KISS_MEMORY_BARRIER();
+        m_sharedState = state;
     }
 
+    kissSegmentQueue &m_queue;
+    bool m_lastSegment;
+    // copy of m_kissState for other cores, see getState()
+    volatile kissState_t m_sharedState;
 };
 
 #endif